@@ -0,0 +1,5 @@
+rm -rf build/
+cmake -B build -DNEED_CHECK=ON
+cmake --build build
+ctest --test-dir build --output-on-failure
+cmake --build build --target bench_check
\ No newline at end of file
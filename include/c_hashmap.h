@@ -3,17 +3,22 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef unsigned int uint;
 
-// get key or value of element
+/*
+ * get key or value of element.
+ * The key pointer returned for an ele in map is cached by its entry, it must stay valid and unchanged while the ele is
+ * in map, unless map interns keys. To change a key, remove the ele and put it again.
+ */
 typedef void *(*attr_get_func)(void *ele);
 // set ele2's value to ele1
 typedef void (*val_update_func)(void *ele1, void *ele2);
 // free space of the given pointer.
 typedef void (*free_func)(void *ele);
 // calculate hash code for the given argument, the input is ele's key, not ele.
-typedef int (*hash_func)(void *k);
+typedef size_t (*hash_func)(void *k);
 // judge if the two is the same, true means the same, the input is ele's key/val, not ele.
 typedef bool (*eq_func)(void *k1, void *k2);
 // produce a val by the key.
@@ -22,17 +27,92 @@ typedef void *(*produce_func)(void *ele);
 typedef bool (*filter_func)(void *ele);
 // return true if need stop.
 typedef bool (*foreach_func)(void *ele);
+// return byte length of the given key, see hashmap_intern_keys.
+typedef size_t (*key_len_func)(void *k);
 
 // ele is the k/v pair
 typedef struct _hash_map_entry {
-    int   hash;
-    void *ele;
+    size_t hash;
+    // byte length of key owned by map, 0 if map does not intern keys.
+    size_t key_len;
+    void  *ele;
+    // cached k_get_f(ele), saves one call and one pointer chase per probed entry. Points to the map's copy if interned.
+    void  *key;
 
     struct _hash_map_entry *next;
 
     free_func free_f;
 } *hash_map_entry;
 
+// interned keys shorter than this are stored right after their entry, with a trailing '\0'. Keeps such entry in 64B.
+#define HASHMAP_INLINE_KEY_SIZE 16
+#define HASHMAP_INLINE_KEY(e) ((char *)((e) + 1))
+#define HASHMAP_KEY_CHUNK_SIZE (64UL << 10)
+
+/*
+ * Map-owned storage of interned keys too long to be inlined, each key is prefixed by a pointer to its chunk.
+ * A chunk is sealed when the map moves on to a new one, and freed when its last key is released after that.
+ */
+typedef struct _hashmap_key_chunk {
+    size_t used;
+    size_t cap;
+    uint   live;
+    bool   sealed;
+
+    char data[] __attribute__((aligned(8)));
+} *hashmap_key_chunk;
+
+/*
+ * Entries allocated in one block, e.g. by hashmap_clone.
+ * Entries inside the slab are not freed one by one, the slab is freed when its last live entry is removed.
+ */
+typedef struct _hashmap_slab {
+    size_t live;
+    size_t cap;
+    // bytes of one entry, including inline key storage.
+    uint   entry_size;
+    // allocated by mmap, see HASHMAP_ALLOC_HUGE_PAGE.
+    bool   mapped;
+
+    char entries[] __attribute__((aligned(8)));
+} *hashmap_slab;
+
+#define COW_SHARED 0
+#define COW_OWNED 1
+#define COW_DROPPED 2
+
+// detached flags of _hashmap_cow, set by the side freed first.
+#define COW_LIVE_GONE 1
+#define COW_SNAP_GONE 2
+
+/*
+ * Copy-on-write state shared by a map and its snapshot.
+ *
+ * The snapshot keeps the bucket array as it was when taken, the live map keeps a copy of it. Both point to the same
+ * entries until the live map modifies a bucket, then the shared entries of that bucket are copied into the live map
+ * (COW_OWNED). Buckets cleared by the live map before being copied are marked as COW_DROPPED, their entries are freed
+ * along with the snapshot. A rehash of the live map copies all shared buckets first.
+ *
+ * Entries removed from the live map are kept in pending, and freed when the snapshot is released, since their eles
+ * may still be visible through the snapshot.
+ *
+ * The snapshot may be read and freed by another thread. Freeing it only sets COW_SNAP_GONE, the release is done by the
+ * live map on its next modification, so all cow state is written by one thread. Whichever side is freed last frees
+ * the shared state.
+ */
+typedef struct _hashmap_cow {
+    struct _hashmap *live;
+    struct _hashmap *snap;
+    size_t           cap;
+    bool             owned_all;
+    unsigned char   *state;
+    hash_map_entry   pending;
+    int              detached;
+} *hashmap_cow;
+
+// change log of map, see c_hashmap_log.h.
+struct _hashmap_log;
+
 /*
  * Careful that _hashmap is not thread safe.
  * free_func of _hashmap can also act as a callback function when removing an entry.
@@ -40,11 +120,27 @@ typedef struct _hash_map_entry {
  * Each entry contains a void *ele pointer, which is the k-v pair.
  */
 typedef struct _hashmap {
-    uint            size;
-    uint            cap;
+    size_t          size;
+    size_t          cap;
     float           expand_factor;
     float           shrink_factor;
     hash_map_entry *bucket;
+    hashmap_slab    slab;
+    int             alloc_mode;
+    // snapshots are read only, and share entries with their source map through cow.
+    bool            read_only;
+    hashmap_cow     cow;
+    // modifications are appended to log if attached.
+    struct _hashmap_log *log;
+
+    // set if map interns keys, long keys are copied into key_chunk.
+    key_len_func      key_len_f;
+    hashmap_key_chunk key_chunk;
+
+    // set if entries are stored in one array, see hashmap_set_dense.
+    char  *dense;
+    size_t dense_len;
+    size_t dense_cap;
 
     attr_get_func   k_get_f;
     attr_get_func   v_get_f;
@@ -55,11 +151,38 @@ typedef struct _hashmap {
     free_func       free_f;
 } *hashmap;
 
+/*
+ * Allocation modes of bucket arrays and entry slabs.
+ * HASHMAP_ALLOC_HUGE_PAGE maps arrays of at least HUGE_PAGE_SIZE with mmap and advises transparent huge pages, so
+ * random probes miss TLB less. Mapped pages are zeroed lazily by the kernel, and bucket arrays are resized in place by
+ * mremap when possible, without keeping the old and new array both resident.
+ * HASHMAP_ALLOC_HUGETLB tries explicit huge pages from the hugetlbfs pool first, then falls back to the former.
+ *
+ * HASHMAP_ALLOC_NODE(node) could be or-ed into a mode, arrays of any size are then mapped and bound to the NUMA node by
+ * mbind, including the arrays of later resizes. Arrays smaller than HUGE_PAGE_SIZE are only rounded up to pages.
+ * Entries put one by one are still allocated by malloc of the putting thread, hashmap_compact moves them into a slab
+ * on the node.
+ */
+#define HASHMAP_ALLOC_DEFAULT 0
+#define HASHMAP_ALLOC_HUGE_PAGE 1
+#define HASHMAP_ALLOC_HUGETLB 2
+#define HASHMAP_ALLOC_MODE_MASK 0xff
+#define HASHMAP_ALLOC_NODE(node) (((node) + 1) << 8)
+// node of alloc_mode, -1 if not bound.
+#define HASHMAP_ALLOC_NODE_OF(alloc_mode) (((alloc_mode) >> 8) - 1)
+#define HASHMAP_MAX_NODE 1024
+#define HUGE_PAGE_SIZE (2UL << 20)
+
 #define DEFAULT_INIT_CAP 8
+// largest power of 2 whose bucket array size does not overflow size_t, leaving room for a rehash.
+#define HASHMAP_MAX_CAP ((SIZE_MAX >> 2) / sizeof(hash_map_entry) + 1)
 #define DEFAULT_EXPAND_FACTOR 0.75
 #define DEFAULT_SHRINK_FACTOR 0.20
-// k/v_get_f could not be null
-hashmap hashmap_new_f(int             init_cap,
+/*
+ * k/v_get_f could not be null, keys returned by k_get_f are cached, see attr_get_func.
+ * init_cap above HASHMAP_MAX_CAP is rejected, such as a negative int converted to size_t.
+ */
+hashmap hashmap_new_f(size_t          init_cap,
                       float           expand_factor,
                       float           shrink_factor,
                       attr_get_func   k_get_f,
@@ -69,8 +192,8 @@ hashmap hashmap_new_f(int             init_cap,
                       eq_func         k_eq_f,
                       eq_func         v_eq_f,
                       free_func       free_f);
-// k/v_get_f could not be null
-hashmap hashmap_new(int             init_cap,
+// k/v_get_f could not be null, init_cap could not exceed HASHMAP_MAX_CAP.
+hashmap hashmap_new(size_t          init_cap,
                     attr_get_func   k_get_f,
                     attr_get_func   v_get_f,
                     val_update_func v_update_f,
@@ -86,6 +209,8 @@ hashmap hashmap_new_default(attr_get_func   k_get_f,
                             eq_func         v_eq_f);
 
 void hashmap_set_free_func(const hashmap map, free_func free_f);
+// set allocation mode of bucket arrays and entry slabs, current bucket array is moved to the new mode.
+bool hashmap_set_alloc_mode(const hashmap map, int alloc_mode);
 
 // returns true if contains the given key.
 bool hashmap_contains_key(const hashmap map, void *ele);
@@ -105,6 +230,41 @@ void *hashmap_get_or_default(const hashmap map, void *ele, void *def_ele);
  */
 void *hashmap_get_or_default_f(const hashmap map, void *ele, produce_func produce_f);
 
+#define HASHMAP_LOOKUP_BUCKET 0
+#define HASHMAP_LOOKUP_CHAIN 1
+#define HASHMAP_LOOKUP_KEY 2
+#define HASHMAP_LOOKUP_DONE 3
+
+/*
+ * One in-flight lookup, owned by caller. A lookup walks the same chain as hashmap_get, but stops after each memory
+ * access it would miss on: hashmap_lookup_step reads what the previous step prefetched, and prefetches the next bucket
+ * slot, entry or key. A scheduler stepping N lookups round-robin hides each hop's cache miss behind the other N - 1.
+ *
+ * The map must not be modified while lookups on it are in flight.
+ */
+typedef struct _hashmap_lookup {
+    int             state;
+    void           *k;
+    size_t          h;
+    // byte length of k if map interns keys.
+    size_t          len;
+    hash_map_entry *slot;
+    hash_map_entry  e;
+    // value of the found ele, NULL if absent, valid once state is HASHMAP_LOOKUP_DONE.
+    void           *val;
+} hashmap_lookup;
+
+// hash the ele's key and prefetch its bucket slot.
+void hashmap_lookup_begin(const hashmap map, hashmap_lookup *l, void *ele);
+// advance the lookup by one memory access, return true if it's done.
+bool hashmap_lookup_step(const hashmap map, hashmap_lookup *l);
+/*
+ * Set vals[i] to the value of eles[i]'s key, or NULL if absent.
+ * Keys are hashed and their bucket slots prefetched in groups of HASHMAP_LOOKUP_BATCH before the chains are walked.
+ */
+#define HASHMAP_LOOKUP_BATCH 16
+void hashmap_get_batch(const hashmap map, void **eles, void **vals, size_t cnt);
+
 // return the put ele's value and set free func to the given ele.
 void *hashmap_put_f(const hashmap map, void *ele, free_func free_f);
 // return the put ele's value.
@@ -123,14 +283,99 @@ void *hashmap_put_if_absent_f(const hashmap map, void *ele, produce_func produce
 // set free function only for one entry with the given ele's key.
 bool hashmap_ele_set_free_func(const hashmap map, void *ele, free_func free_f);
 
+/*
+ * Let map own a copy of each key, so probing compares length and bytes of keys stored next to entries, instead of
+ * chasing ele and then its key. Keys shorter than HASHMAP_INLINE_KEY_SIZE are stored inline after the entry, longer
+ * ones in chunks owned by map. k_eq_f is not used then, hash_f must only depend on key bytes.
+ *
+ * Could only be called on an empty map without snapshot. Merging into such a map runs in the caller thread.
+ */
+bool hashmap_intern_keys(const hashmap map, key_len_func key_len_f);
+
+/*
+ * Store entries of map in one dense array instead of allocating them one by one, buckets still chain entries inside
+ * it. Full scans (foreach, contains_value, clear, remove_if, intersect/diff) sweep the array linearly instead of
+ * visiting every bucket, a removed entry is filled by moving the last one into it. The array grows along with buckets,
+ * chains are rebuilt when it's reallocated, so entries move on puts and removals.
+ *
+ * Could only be called on an empty map without snapshot. A dense map could not be snapshotted, its clone is not dense,
+ * and merge/intersect/diff into it run in the caller thread.
+ */
+bool hashmap_set_dense(const hashmap map);
+
+// expand capacity in one rehash, so putting size entries in total will not expand on the way.
+bool hashmap_reserve(const hashmap map, size_t size);
+
+/*
+ * Bytes held by a map, see hashmap_memory_usage.
+ * Entries and key chunks shared between a map and its snapshot are counted by both.
+ */
+typedef struct _hashmap_mem_usage {
+    // bucket array, cap pointers.
+    size_t bucket;
+    // entries, including inline keys.
+    size_t entry;
+    // interned long keys, each key chunk is split evenly among the keys in it.
+    size_t key;
+    // malloc headers and rounding of entries, unused slab slots, huge page rounding, map and snapshot headers.
+    size_t overhead;
+    size_t total;
+} hashmap_mem_usage;
+
+// walk all entries of map and sum up their memory, O(cap + size).
+hashmap_mem_usage hashmap_memory_usage(const hashmap map);
+/*
+ * Shrink map to the smallest capacity it would expand to for its size in one rehash, then move all entries into one
+ * slab in bucket order, so later scans walk entries sequentially. Eles are not moved.
+ * If map has a snapshot, only the capacity is shrunk, entries stay shared with the snapshot.
+ */
+bool hashmap_compact(const hashmap map);
+
+/*
+ * Bulk operations between two maps, dst is modified in place and src/other is only read.
+ * If both maps use the same hash_func, hashes stored in entries are reused instead of calling hash_func again.
+ *
+ * With thread_cnt > 1, buckets are split among threads, so merge_f must be thread safe then, free_func is still
+ * called in the caller thread. merge runs in parallel only if both maps use the same hash_func, intersect/diff only if
+ * dst has no snapshot, otherwise they run in the caller thread.
+ */
+/*
+ * Put all eles of src into dst, capacity of dst is reserved for both sizes first.
+ * Conflicts are resolved by merge_f(dst_ele, src_ele), or by dst's val_update_func if merge_f is NULL.
+ * Eles are shared with src, the new entries have no ele-level free_func, but dst's map-level free_func still applies
+ * to them, make sure only one map frees them. Return count of new entries in dst.
+ */
+size_t hashmap_merge_into(const hashmap dst, const hashmap src, val_update_func merge_f, int thread_cnt);
+// remove entries of dst whose keys are absent in other, return removed count.
+size_t hashmap_intersect(const hashmap dst, const hashmap other, int thread_cnt);
+// remove entries of dst whose keys are present in other, return removed count.
+size_t hashmap_diff(const hashmap dst, const hashmap other, int thread_cnt);
+
 // returned value may be invalid caused by free_func.
-void *hashmap_remove(const hashmap map, void *ele);
+void  *hashmap_remove(const hashmap map, void *ele);
 // return removed entry count.
-uint  hashmap_remove_if(const hashmap map, filter_func filter_f);
+size_t hashmap_remove_if(const hashmap map, filter_func filter_f);
 // clear all entries without shrink capacity.
-void  hashmap_clear(const hashmap map);
-// free all hashmap space(including entry's key & value) using the registered free_func.
-void  hashmap_free(hashmap map);
+void   hashmap_clear(const hashmap map);
+// free all hashmap space(including entry's key & value) using the registered free_func, or release a snapshot.
+void   hashmap_free(hashmap map);
+
+/*
+ * Take a read only point-in-time view of map, which can be read by all non-modifying functions, release it by
+ * hashmap_free. The snapshot shares entries with map, buckets are copied lazily on the first modification of map.
+ *
+ * Only one snapshot of a map can be alive at a time. Eles are not copied, so changes made by val_update_func are
+ * visible through the snapshot, and free_func of entries removed from map is deferred until the snapshot is released.
+ *
+ * The snapshot could be read and freed by another thread while map is being modified, e.g. to serialize it in
+ * background. Its memory and the deferred entries are then released by map's next modification, or by hashmap_free.
+ */
+hashmap hashmap_snapshot(const hashmap map);
+/*
+ * Copy map's entries into one slab without re-hashing. Eles are shared with map, so the clone has no free_func by
+ * default.
+ */
+hashmap hashmap_clone(const hashmap map);
 
 /*
  * Careful that _hashmap_iterator is not thread safe.
@@ -152,10 +397,10 @@ void        hashmap_itr_set_foreach_f(const hashmap_itr itr, foreach_func foreac
 
 /*
  * Iterator hashmap and apply the registered function of itr.
- * Stop if the foreach_f returns true.
+ * Stop if the foreach_f returns true, and return true if stopped.
  * Apply foreach_f only if meets the condition of filter_f(if registered).
  */
-void hashmap_foreach(const hashmap map, const hashmap_itr itr);
+bool hashmap_foreach(const hashmap map, const hashmap_itr itr);
 
 /*
  * util functions
@@ -165,27 +410,41 @@ static bool is_power_of_2(long s) {
     return !(s & (s - 1));
 }
 
-static uint round_up_power_of_2(uint n) {
+static size_t round_up_power_of_2(size_t n) {
     n--;
-    n |= n >> 1;
-    n |= n >> 2;
-    n |= n >> 4;
-    n |= n >> 8;
-    n |= n >> 16;
+    for (size_t s = 1; s < sizeof(size_t) * 8; s <<= 1) n |= n >> s;
     n++;
     return n;
 }
 
-static int int_hash(int i) {
-    return (i == 0) ? 0 : i ^ (i >> 16);
+/*
+ * Finalizer of murmur3, every input bit affects all output bits. Buckets are indexed by the low bits and shards by the
+ * high bits, so both ends need to be mixed even if hash_func only fills the low 32 bits.
+ */
+static size_t int_hash(size_t i) {
+#if SIZE_MAX > 0xffffffffu
+    i ^= i >> 33;
+    i *= 0xff51afd7ed558ccdULL;
+    i ^= i >> 33;
+    i *= 0xc4ceb9fe1a85ec53ULL;
+    i ^= i >> 33;
+#else
+    i ^= i >> 16;
+    i *= 0x85ebca6bu;
+    i ^= i >> 13;
+    i *= 0xc2b2ae35u;
+    i ^= i >> 16;
+#endif
+    return i;
 }
 
-static int hash(hash_func hash_f, void *k) {
+static size_t hash(hash_func hash_f, void *k) {
     return int_hash(hash_f(k));
 }
 
-static int str_hash_func(void *k) {
-    int         h = 0;
+static size_t str_hash_func(void *k) {
+    // unsigned, overflow wraps around instead of being undefined.
+    size_t      h = 0;
     const char *c = (char *)k;
     while (*c != '\0') {
         h += h * 7 + *c;
@@ -194,7 +453,7 @@ static int str_hash_func(void *k) {
     return h;
 }
 
-static int ptr_hash_func(void *k) {
+static size_t ptr_hash_func(void *k) {
     return *((long *)k);
 }
 
@@ -206,6 +465,12 @@ static bool int_eq_func(void *k1, void *k2) {
     return *(int *)k1 == *(int *)k2;
 }
 
+static size_t str_key_len_func(void *k) {
+    const char *c = (char *)k;
+    while (*c != '\0') c++;
+    return c - (char *)k;
+}
+
 static bool str_eq_func(void *k1, void *k2) {
     const char *c1 = (char *)k1;
     const char *c2 = (char *)k2;
@@ -0,0 +1,98 @@
+#ifndef C_HASH_MAP_LOG_H
+#define C_HASH_MAP_LOG_H
+
+#include "c_hashmap.h"
+#include <pthread.h>
+#include <stdint.h>
+
+// write ele into buf and return the bytes needed, nothing should be written if it's larger than cap.
+typedef size_t (*serialize_func)(void *ele, void *buf, size_t cap);
+// produce a new ele from the bytes written by serialize_func.
+typedef void *(*deserialize_func)(const void *buf, size_t len);
+
+#define LOG_OP_PUT 1
+#define LOG_OP_REMOVE 2
+#define LOG_OP_CLEAR 3
+
+// op(1 byte) + payload length(4 bytes) + checksum(4 bytes), followed by payload.
+#define LOG_RECORD_HEADER_SIZE 9
+#define LOG_INIT_BUF_SIZE 4096
+// writer waits this long for more records before a group commit, unless someone is waiting for durability.
+#define LOG_GROUP_COMMIT_US 2000
+
+/*
+ * Append-only change log of a _hashmap.
+ *
+ * hashmap_put_f, hashmap_remove, hashmap_remove_if, hashmap_clear and the bulk operations append records to an
+ * in-memory buffer, a background writer swaps the buffer out and writes it with one fdatasync per batch, so the map
+ * thread never waits for the disk. Records appended after the last durable batch are lost on crash, call
+ * hashmap_log_sync to wait for them.
+ *
+ * Compaction takes a snapshot of the map, the writer serializes it to a new file, appends the records that came after,
+ * and renames it over the log, so the map thread only pays for the snapshot. Eles are shared with the snapshot, so
+ * ser_f may read an ele while val_update_func changes it, the put record logged for that update fixes it on replay.
+ * Dense maps and maps with another snapshot alive are serialized in the caller thread instead, and hashmap_snapshot
+ * fails until the writer is done with the compaction snapshot.
+ */
+typedef struct _hashmap_log {
+    hashmap          map;
+    char            *path;
+    int              fd;
+    serialize_func   ser_f;
+    deserialize_func de_f;
+    free_func        tmp_free_f;
+
+    pthread_t       writer;
+    pthread_mutex_t lock;
+    // signaled when records are appended or writer should stop.
+    pthread_cond_t  wake;
+    // signaled when a batch becomes durable.
+    pthread_cond_t  durable_cond;
+
+    // records appended by map thread, swapped with spare by writer.
+    char    *buf;
+    size_t   len;
+    size_t   cap;
+    char    *spare;
+    size_t   spare_cap;
+    uint64_t appended;
+    uint64_t durable;
+    uint     sync_waiters;
+    bool     stop;
+    bool     failed;
+
+    // pending compaction, records in buf before compact_off are already in compact_snap, or compact_buf if no snapshot.
+    bool     compact_pending;
+    // failure of the last compaction, reported and cleared by hashmap_log_sync.
+    bool     compact_failed;
+    // sequence of the last requested and the last finished compaction.
+    uint64_t compact_req;
+    uint64_t compact_done;
+    hashmap  compact_snap;
+    char    *compact_buf;
+    size_t   compact_len;
+    size_t   compact_off;
+} *hashmap_log;
+
+/*
+ * Replay the log at path into map and attach it to map, the file is created if absent.
+ * Capacity of map is reserved for all put records first, and shrunk to fit after replay if records are mostly updates
+ * of the same keys. Eles of put records with a new key are put into map, other
+ * eles are freed by tmp_free_f after being applied. Return NULL if the log could not be opened or replayed.
+ */
+hashmap_log hashmap_log_open(const hashmap   map,
+                             const char      *path,
+                             serialize_func   ser_f,
+                             deserialize_func de_f,
+                             free_func        tmp_free_f);
+/*
+ * Wait until all appended records and requested compactions are done, return false if writing failed, or if a
+ * compaction failed since the last sync. Records are still written to the old log if its compaction fails.
+ */
+bool hashmap_log_sync(const hashmap map);
+// rewrite log from current entries of map in background, see hashmap_log_sync for its result.
+bool hashmap_log_compact(const hashmap map);
+// flush all records, stop the writer and detach log from map.
+bool hashmap_log_close(const hashmap map);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef C_HASH_MAP_SHARD_H
+#define C_HASH_MAP_SHARD_H
+
+#include "c_hashmap.h"
+#include <pthread.h>
+
+#define SHARD_CACHE_LINE 64
+
+/*
+ * One partition of a _sharded_hashmap.
+ * Aligned to a cache line so locks of neighbour shards never share a line.
+ */
+typedef struct _hashmap_shard {
+    pthread_rwlock_t lock;
+    hashmap          map;
+} __attribute__((aligned(SHARD_CACHE_LINE))) *hashmap_shard;
+
+/*
+ * _sharded_hashmap partitions keys by the high bits of their hash into independent _hashmap shards, the low bits are
+ * left to index buckets inside the shard. Each shard has its own lock and resizes on its own, so a rehash of one hot
+ * shard does not stall lookups in the others.
+ *
+ * Shards are created lazily by the first thread putting into them, with no NUMA placement. To place a shard on a node,
+ * its owner thread calls sharded_hashmap_shard_init() with the node, the shard is then allocated by that thread and
+ * its bucket arrays are bound to the node by mbind, for all later resizes too. Entries are allocated by the putting
+ * thread, route puts of a shard to its owner by sharded_hashmap_shard_of() to keep them on the node as well.
+ *
+ * Values returned by get/put functions are read after the shard lock is released, keep them valid by not removing
+ * the entry concurrently.
+ */
+typedef struct _sharded_hashmap {
+    uint   shard_bits;
+    uint   shard_cnt;
+    size_t shard_init_cap;
+    float  expand_factor;
+    float  shrink_factor;
+
+    attr_get_func   k_get_f;
+    attr_get_func   v_get_f;
+    val_update_func v_update_f;
+    hash_func       hash_f;
+    eq_func         k_eq_f;
+    eq_func         v_eq_f;
+    free_func       free_f;
+
+    hashmap_shard shards;
+} *sharded_hashmap;
+
+#define DEFAULT_SHARD_CNT 16
+/*
+ * shard_cnt will be round up to power of 2, init_cap is the total capacity of all shards and could not exceed
+ * HASHMAP_MAX_CAP. k/v_get_f could not be null
+ */
+sharded_hashmap sharded_hashmap_new(uint            shard_cnt,
+                                    size_t          init_cap,
+                                    attr_get_func   k_get_f,
+                                    attr_get_func   v_get_f,
+                                    val_update_func v_update_f,
+                                    hash_func       hash_f,
+                                    eq_func         k_eq_f,
+                                    eq_func         v_eq_f);
+
+// should be called before any concurrent access.
+void sharded_hashmap_set_free_func(const sharded_hashmap smap, free_func free_f);
+
+/*
+ * Create the given shard on the calling thread if absent. With node >= 0, its bucket arrays are bound to that NUMA
+ * node, an existing bucket array is moved there. Return false if the shard could not be created or bound.
+ */
+bool sharded_hashmap_shard_init(const sharded_hashmap smap, uint shard_idx, int node);
+// return the index of shard which the given ele's key belongs to.
+uint sharded_hashmap_shard_of(const sharded_hashmap smap, void *ele);
+
+bool   sharded_hashmap_contains_key(const sharded_hashmap smap, void *ele);
+void  *sharded_hashmap_get(const sharded_hashmap smap, void *ele);
+void  *sharded_hashmap_put(const sharded_hashmap smap, void *ele);
+void  *sharded_hashmap_put_if_absent(const sharded_hashmap smap, void *ele, void *def_ele);
+void  *sharded_hashmap_remove(const sharded_hashmap smap, void *ele);
+// sum of all shards' size, not a consistent view under concurrent modification.
+size_t sharded_hashmap_size(const sharded_hashmap smap);
+// iterate shards one by one, each shard is locked while being iterated.
+void   sharded_hashmap_foreach(const sharded_hashmap smap, const hashmap_itr itr);
+// not thread safe, make sure all other threads have stopped accessing the map.
+void   sharded_hashmap_free(sharded_hashmap smap);
+
+#endif
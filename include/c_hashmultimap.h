@@ -0,0 +1,65 @@
+#ifndef C_HASH_MULTI_MAP_H
+#define C_HASH_MULTI_MAP_H
+
+#include "c_hashmap.h"
+
+/*
+ * All eles with the same key, kept in insertion order in one contiguous block.
+ * key is taken from eles[0].
+ */
+typedef struct _hashmultimap_vals {
+    void  *key;
+    size_t size;
+    size_t cap;
+    void  *eles[];
+} *hashmultimap_vals;
+
+/*
+ * Careful that _hashmultimap is not thread safe.
+ * _hashmultimap maps one key to multiple eles, each key is one entry of the underlying _hashmap, and its eles are
+ * stored in one _hashmultimap_vals block used as the entry's ele, instead of a linked list of values. The block is
+ * malloc'd apart from the entry and realloc'd as eles are appended.
+ *
+ * ele_eq_f judges if two eles are the same, it's used when removing one ele.
+ * free_func of _hashmultimap also acts as a callback function when removing an ele.
+ */
+typedef struct _hashmultimap {
+    size_t        size;
+    hashmap       map;
+    attr_get_func k_get_f;
+    eq_func       ele_eq_f;
+    free_func     free_f;
+} *hashmultimap;
+
+#define MULTI_MAP_INIT_VALS_CAP 2
+// k_get_f could not be null, init_cap could not exceed HASHMAP_MAX_CAP.
+hashmultimap hashmultimap_new(size_t        init_cap,
+                              attr_get_func k_get_f,
+                              hash_func     hash_f,
+                              eq_func       k_eq_f,
+                              eq_func       ele_eq_f);
+void         hashmultimap_set_free_func(const hashmultimap mm, free_func free_f);
+
+// append ele to eles of its key.
+bool  hashmultimap_put(const hashmultimap mm, void *ele);
+/*
+ * Get eles with the given ele's key and set the count to cnt, return NULL if the key is absent.
+ * The returned array is invalid after the next modification of the key.
+ */
+void **hashmultimap_get(const hashmultimap mm, void *ele, size_t *cnt);
+bool   hashmultimap_contains_key(const hashmultimap mm, void *ele);
+// return count of eles with the given ele's key.
+size_t hashmultimap_count(const hashmultimap mm, void *ele);
+// remove the first stored ele equals to ele by ele_eq_f.
+bool   hashmultimap_remove(const hashmultimap mm, void *ele);
+// remove all eles with the given ele's key, return removed count.
+size_t hashmultimap_remove_key(const hashmultimap mm, void *ele);
+// count of all eles.
+size_t hashmultimap_size(const hashmultimap mm);
+
+// apply itr to every ele, stop if the foreach_f returns true, and return true if stopped.
+bool hashmultimap_foreach(const hashmultimap mm, const hashmap_itr itr);
+// free all hashmultimap space using the registered free_func.
+void hashmultimap_free(hashmultimap mm);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef C_HASH_SET_H
+#define C_HASH_SET_H
+
+#include "c_hashmap.h"
+
+/*
+ * Careful that _hashset is not thread safe.
+ * _hashset only keeps membership of eles' keys, it's built on _hashmap but never calls value getter or update
+ * functions. free_func of _hashset also acts as a callback function when removing an ele.
+ */
+typedef struct _hashset {
+    hashmap map;
+} *hashset;
+
+// k_get_f could not be null, init_cap could not exceed HASHMAP_MAX_CAP.
+hashset hashset_new(size_t init_cap, attr_get_func k_get_f, hash_func hash_f, eq_func k_eq_f);
+void    hashset_set_free_func(const hashset set, free_func free_f);
+
+// return true if the ele's key is absent and ele is added.
+bool   hashset_add(const hashset set, void *ele);
+// returns true if contains the given ele's key.
+bool   hashset_contains(const hashset set, void *ele);
+// return true if the ele's key is present and removed.
+bool   hashset_remove(const hashset set, void *ele);
+size_t hashset_size(const hashset set);
+
+/*
+ * Batch operations, dst is modified in place and other is left untouched. Hashes stored in other are reused if both
+ * sets use the same hash_func.
+ * Eles added by union are shared with other, make sure only one set frees them.
+ */
+// add eles of other whose keys are absent in dst, return added count.
+size_t hashset_union(const hashset dst, const hashset other);
+// remove eles of dst whose keys are absent in other, return removed count.
+size_t hashset_intersect(const hashset dst, const hashset other);
+// remove eles of dst whose keys are present in other, return removed count.
+size_t hashset_difference(const hashset dst, const hashset other);
+
+// same as hashmap_foreach.
+bool hashset_foreach(const hashset set, const hashmap_itr itr);
+// free all hashset space using the registered free_func.
+void hashset_free(hashset set);
+
+#endif
@@ -1,8 +1,244 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "c_hashmap.h"
+#include "c_hashmap_internal.h"
+#include "c_hashmap_log.h"
 #include "limits.h"
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <linux/mempolicy.h>
+
+bool _hashmap_use_mmap(int alloc_mode, size_t bytes) {
+    // arrays bound to a node are always mapped.
+    if (HASHMAP_ALLOC_NODE_OF(alloc_mode) >= 0) return true;
+    return alloc_mode != HASHMAP_ALLOC_DEFAULT && bytes >= HUGE_PAGE_SIZE;
+}
+
+size_t _hashmap_mapped_size(size_t bytes) {
+    size_t align = bytes < HUGE_PAGE_SIZE ? (size_t)sysconf(_SC_PAGESIZE) : HUGE_PAGE_SIZE;
+    return (bytes + align - 1) & ~(align - 1);
+}
+
+// bind pages of p to node, before they are touched. Kernels without NUMA have only one node.
+bool _hashmap_mbind(void *p, size_t size, int node) {
+#ifdef SYS_mbind
+    unsigned long mask[HASHMAP_MAX_NODE / (8 * sizeof(unsigned long))] = {0};
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    // the kernel takes maxnode - 1 bits of mask.
+    if (syscall(SYS_mbind, p, size, MPOL_BIND, mask, sizeof(mask) * 8 + 1, 0) != 0 && errno != ENOSYS) return false;
+#endif
+    return true;
+}
+
+// zero-filled memory, pages are only populated when touched.
+void *_hashmap_mmap(int alloc_mode, size_t bytes) {
+    size_t size = _hashmap_mapped_size(bytes);
+    int    mode = alloc_mode & HASHMAP_ALLOC_MODE_MASK, node = HASHMAP_ALLOC_NODE_OF(alloc_mode);
+    void  *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (mode == HASHMAP_ALLOC_HUGETLB && size >= HUGE_PAGE_SIZE)
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (p == MAP_FAILED) p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+    if (mode != HASHMAP_ALLOC_DEFAULT && size >= HUGE_PAGE_SIZE) madvise(p, size, MADV_HUGEPAGE);
+#endif
+    if (node >= 0 && !_hashmap_mbind(p, size, node)) {
+        munmap(p, size);
+        return NULL;
+    }
+    return p;
+}
+
+hash_map_entry *_hashmap_bucket_alloc(int alloc_mode, size_t cap) {
+    size_t bytes = cap * sizeof(hash_map_entry);
+    if (_hashmap_use_mmap(alloc_mode, bytes)) return (hash_map_entry *)_hashmap_mmap(alloc_mode, bytes);
+    return (hash_map_entry *)calloc(cap, sizeof(hash_map_entry));
+}
+
+void _hashmap_bucket_free(int alloc_mode, hash_map_entry *bucket, size_t cap) {
+    size_t bytes = cap * sizeof(hash_map_entry);
+    if (_hashmap_use_mmap(alloc_mode, bytes)) munmap(bucket, _hashmap_mapped_size(bytes));
+    else free(bucket);
+}
+
+hashmap_slab _hashmap_slab_alloc(int alloc_mode, size_t cap, size_t entry_size) {
+    size_t       bytes = sizeof(struct _hashmap_slab) + cap * entry_size;
+    bool         mapped = _hashmap_use_mmap(alloc_mode, bytes);
+    hashmap_slab slab = mapped ? (hashmap_slab)_hashmap_mmap(alloc_mode, bytes) : (hashmap_slab)malloc(bytes);
+    if (slab == NULL) return NULL;
+
+    slab->live = slab->cap = cap;
+    slab->entry_size = entry_size;
+    slab->mapped = mapped;
+    return slab;
+}
+
+void _hashmap_slab_free(hashmap_slab slab) {
+    if (slab == NULL) return;
+    size_t bytes = sizeof(struct _hashmap_slab) + slab->cap * slab->entry_size;
+    if (slab->mapped) munmap(slab, _hashmap_mapped_size(bytes));
+    else free(slab);
+}
+
+// entries of map interning keys have room for an inline key.
+size_t _hashmap_entry_size(const hashmap map) {
+    return sizeof(struct _hash_map_entry) + (map->key_len_f == NULL ? 0 : HASHMAP_INLINE_KEY_SIZE);
+}
+
+void _hashmap_key_chunk_seal(hashmap_key_chunk chunk) {
+    if (chunk == NULL) return;
+    chunk->sealed = true;
+    if (chunk->live == 0) free(chunk);
+}
+
+hashmap_key_chunk _hashmap_key_chunk_of(hash_map_entry e) {
+    return *(hashmap_key_chunk *)((char *)e->key - sizeof(hashmap_key_chunk));
+}
+
+// allocate len bytes and a trailing '\0' for a long key.
+char *_hashmap_key_alloc(const hashmap map, size_t len) {
+    // chunk pointer + key + '\0', rounded up to keep the next chunk pointer aligned.
+    size_t            need = (sizeof(hashmap_key_chunk) + len + 1 + 7) & ~(size_t)7;
+    hashmap_key_chunk chunk = map->key_chunk;
+    if (chunk == NULL || chunk->used + need > chunk->cap) {
+        size_t cap = need > HASHMAP_KEY_CHUNK_SIZE ? need : HASHMAP_KEY_CHUNK_SIZE;
+        if ((chunk = (hashmap_key_chunk)malloc(sizeof(struct _hashmap_key_chunk) + cap)) == NULL) return NULL;
+        chunk->used = 0;
+        chunk->cap = cap;
+        chunk->live = 0;
+        // an oversized key gets a chunk of its own, the current one keeps being filled.
+        chunk->sealed = cap > HASHMAP_KEY_CHUNK_SIZE;
+        if (!chunk->sealed) {
+            _hashmap_key_chunk_seal(map->key_chunk);
+            map->key_chunk = chunk;
+        }
+    }
+
+    char *p = chunk->data + chunk->used;
+    chunk->used += need;
+    chunk->live++;
+    *(hashmap_key_chunk *)p = chunk;
+    return p + sizeof(hashmap_key_chunk);
+}
+
+// release the interned key of e, its chunk is reused if still being filled, or freed if sealed.
+void _hashmap_key_release(hash_map_entry e) {
+    if (e->key_len < HASHMAP_INLINE_KEY_SIZE) return;
+
+    hashmap_key_chunk chunk = _hashmap_key_chunk_of(e);
+    if (--chunk->live > 0) return;
+    if (chunk->sealed) free(chunk);
+    else chunk->used = 0;
+}
+
+// set key of a new entry, it's copied into entry or key chunk if map interns keys.
+bool _hashmap_entry_set_key(const hashmap map, hash_map_entry e, void *k) {
+    e->key_len = 0;
+    e->key = k;
+    if (map->key_len_f == NULL) return true;
+
+    size_t len = map->key_len_f(k);
+    // leave room for the chunk pointer and '\0' without overflow.
+    if (len > SIZE_MAX / 2) return false;
+    if (len < HASHMAP_INLINE_KEY_SIZE) e->key = HASHMAP_INLINE_KEY(e);
+    else if ((e->key = _hashmap_key_alloc(map, len)) == NULL) return false;
+    memcpy(e->key, k, len);
+    ((char *)e->key)[len] = '\0';
+    e->key_len = len;
+    return true;
+}
+
+// dense entry of index i.
+hash_map_entry _hashmap_dense_at(const hashmap map, size_t i) {
+    return (hash_map_entry)(map->dense + i * _hashmap_entry_size(map));
+}
+
+// entries a dense map could hold before cap expands.
+size_t _hashmap_dense_cap(const hashmap map, size_t cap) {
+    return (size_t)(map->expand_factor * cap) + 1;
+}
+
+// reallocate dense storage to dense_cap entries, and rebuild all chains into a new array of new_cap buckets.
+bool _hashmap_dense_resize(const hashmap map, size_t new_cap, size_t dense_cap) {
+    size_t          entry_size = _hashmap_entry_size(map);
+    hash_map_entry *bucket = _hashmap_bucket_alloc(map->alloc_mode, new_cap);
+    char           *dense = bucket == NULL ? NULL : (char *)realloc(map->dense, dense_cap * entry_size);
+    if (dense == NULL) {
+        if (bucket != NULL) _hashmap_bucket_free(map->alloc_mode, bucket, new_cap);
+        perror("no enough memory");
+        return false;
+    }
+
+    _hashmap_bucket_free(map->alloc_mode, map->bucket, map->cap);
+    map->bucket = bucket;
+    map->cap = new_cap;
+    map->dense = dense;
+    map->dense_cap = dense_cap;
+    for (size_t i = 0; i < map->dense_len; i++) {
+        hash_map_entry e = (hash_map_entry)(dense + i * entry_size);
+        if (map->key_len_f != NULL && e->key_len < HASHMAP_INLINE_KEY_SIZE) e->key = HASHMAP_INLINE_KEY(e);
+        size_t idx = _hashmap_cul_index(new_cap, e->hash);
+        e->next = bucket[idx];
+        bucket[idx] = e;
+    }
+    return true;
+}
+
+// unlink dense entry e from its bucket.
+void _hashmap_dense_unlink(const hashmap map, hash_map_entry e) {
+    hash_map_entry *link = &map->bucket[_hashmap_cul_index(map->cap, e->hash)];
+    while (*link != e) link = &(*link)->next;
+    *link = e->next;
+}
 
-hashmap hashmap_new_f(int             init_cap,
+// fill the hole of unlinked entry e by moving the last dense entry into it.
+void _hashmap_dense_remove(const hashmap map, hash_map_entry e) {
+    hash_map_entry last = _hashmap_dense_at(map, --map->dense_len);
+    if (last == e) return;
+
+    hash_map_entry *link = &map->bucket[_hashmap_cul_index(map->cap, last->hash)];
+    while (*link != last) link = &(*link)->next;
+    *link = e;
+    memcpy(e, last, _hashmap_entry_size(map));
+    if (map->key_len_f != NULL && e->key_len < HASHMAP_INLINE_KEY_SIZE) e->key = HASHMAP_INLINE_KEY(e);
+}
+
+hash_map_entry _hashmap_entry_new(const hashmap map, void *ele, void *k, size_t h, free_func free_f) {
+    hash_map_entry e;
+    if (map->dense == NULL) e = (hash_map_entry)malloc(_hashmap_entry_size(map));
+    // dense storage only runs out at HASHMAP_MAX_CAP, it grows along with buckets otherwise.
+    else e = map->dense_len < map->dense_cap ? _hashmap_dense_at(map, map->dense_len) : NULL;
+    if (e == NULL || !_hashmap_entry_set_key(map, e, k)) {
+        if (map->dense == NULL) free(e);
+        perror("no enough memory");
+        return NULL;
+    }
+    if (map->dense != NULL) map->dense_len++;
+    e->hash = h;
+    e->ele = ele;
+    e->next = NULL;
+    e->free_f = free_f;
+    return e;
+}
+
+// copy e into ne of the same map, long interned keys are shared with e.
+void _hashmap_entry_copy(const hashmap map, hash_map_entry ne, hash_map_entry e) {
+    memcpy(ne, e, _hashmap_entry_size(map));
+    if (map->key_len_f == NULL) return;
+    if (e->key_len < HASHMAP_INLINE_KEY_SIZE) ne->key = HASHMAP_INLINE_KEY(ne);
+    else _hashmap_key_chunk_of(e)->live++;
+}
+
+hashmap hashmap_new_f(size_t          init_cap,
                       float           expand_factor,
                       float           shrink_factor,
                       attr_get_func   k_get_f,
@@ -12,24 +248,26 @@ hashmap hashmap_new_f(int             init_cap,
                       eq_func         k_eq_f,
                       eq_func         v_eq_f,
                       free_func       free_f) {
+    // a negative init_cap wraps to above HASHMAP_MAX_CAP.
+    if (k_get_f == NULL || v_get_f == NULL || v_update_f == NULL || init_cap > HASHMAP_MAX_CAP) goto arg_error;
+
     hashmap map = (hashmap)calloc(1, sizeof(struct _hashmap));
     if (map == NULL) goto mem_error;
 
     map->size = 0;
-    if (init_cap <= 0) init_cap = DEFAULT_INIT_CAP;
-    // avoid overflow
-    if (init_cap >= INT_MAX >> 1) map->cap = INT_MAX;
+    if (init_cap == 0) init_cap = DEFAULT_INIT_CAP;
+    // avoid overflow, cap must stay a power of 2 for indexing by h & (cap - 1).
+    if (init_cap >= HASHMAP_MAX_CAP) map->cap = HASHMAP_MAX_CAP;
     else map->cap = round_up_power_of_2(init_cap);
 
     map->expand_factor = expand_factor < 0.5 || expand_factor >= 1 ? DEFAULT_EXPAND_FACTOR : expand_factor;
     map->shrink_factor = shrink_factor < 0.1 || shrink_factor >= 0.5 ? DEFAULT_SHRINK_FACTOR : shrink_factor;
 
-    if (k_get_f == NULL || v_get_f == NULL || v_update_f == NULL) goto arg_error;
     map->k_get_f = k_get_f;
     map->v_get_f = v_get_f;
     map->v_update_f = v_update_f;
 
-    map->bucket = (hash_map_entry *)calloc(map->cap, sizeof(hash_map_entry));
+    map->bucket = _hashmap_bucket_alloc(map->alloc_mode, map->cap);
     if (map->bucket == NULL) goto mem_error;
 
     map->hash_f = hash_f == NULL ? &ptr_hash_func : hash_f;
@@ -44,11 +282,11 @@ mem_error:
     return NULL;
 
 arg_error:
-    perror("argument k/v_get_f could not be null");
+    perror("argument k/v_get_f could not be null, or init_cap exceeds HASHMAP_MAX_CAP");
     return NULL;
 }
 
-hashmap hashmap_new(int             init_cap,
+hashmap hashmap_new(size_t          init_cap,
                     attr_get_func   k_get_f,
                     attr_get_func   v_get_f,
                     val_update_func v_update_f,
@@ -80,10 +318,82 @@ void hashmap_set_free_func(const hashmap map, free_func free_f) {
     map->free_f = free_f;
 }
 
-int _hashmap_cul_index(uint cap, int h) {
+bool hashmap_set_alloc_mode(const hashmap map, int alloc_mode) {
+    if (map->read_only || HASHMAP_ALLOC_NODE_OF(alloc_mode) >= HASHMAP_MAX_NODE) {
+        perror("hashmap is read only, or node of alloc_mode is out of range");
+        return false;
+    }
+    if (alloc_mode == map->alloc_mode) return true;
+
+    hash_map_entry *bucket = _hashmap_bucket_alloc(alloc_mode, map->cap);
+    if (bucket == NULL) {
+        perror("no enough memory");
+        return false;
+    }
+
+    memcpy(bucket, map->bucket, map->cap * sizeof(hash_map_entry));
+    _hashmap_bucket_free(map->alloc_mode, map->bucket, map->cap);
+    map->bucket = bucket;
+    map->alloc_mode = alloc_mode;
+    return true;
+}
+
+size_t _hashmap_cul_index(size_t cap, size_t h) {
     return h & (cap - 1);
 }
 
+// copy the entries of bucket idx still shared with snapshot, so the bucket can be modified.
+bool _hashmap_cow_own_bucket(const hashmap map, size_t idx) {
+    hashmap_cow cow = map->cow;
+    if (cow == NULL || cow->owned_all || cow->state[idx] != COW_SHARED) return true;
+
+    // live map only head-inserts into a shared bucket, so shared entries are the tail starting at snapshot's head.
+    hash_map_entry  shared = cow->snap->bucket[idx];
+    hash_map_entry *link = &map->bucket[idx];
+    while (*link != shared) link = &(*link)->next;
+
+    // copy aside first, a failed allocation leaves the bucket untouched.
+    hash_map_entry  head = NULL, ne;
+    hash_map_entry *tail = &head;
+    for (hash_map_entry e = shared; e != NULL; e = e->next) {
+        if ((ne = (hash_map_entry)malloc(_hashmap_entry_size(map))) == NULL) goto error;
+        _hashmap_entry_copy(map, ne, e);
+        ne->next = NULL;
+        *tail = ne;
+        tail = &ne->next;
+    }
+
+    *link = head;
+    cow->state[idx] = COW_OWNED;
+    return true;
+
+error:
+    while (head != NULL) {
+        ne = head->next;
+        _hashmap_key_release(head);
+        free(head);
+        head = ne;
+    }
+    perror("no enough memory");
+    return false;
+}
+
+// true if bucket idx still shares its entries with snapshot.
+bool _hashmap_cow_is_shared(const hashmap map, size_t idx) {
+    return map->cow != NULL && !map->cow->owned_all && map->cow->state[idx] == COW_SHARED;
+}
+
+bool _hashmap_cow_own_all(const hashmap map) {
+    hashmap_cow cow = map->cow;
+    if (cow == NULL || cow->owned_all) return true;
+
+    for (size_t i = 0; i < cow->cap; i++) {
+        if (!_hashmap_cow_own_bucket(map, i)) return false;
+    }
+    cow->owned_all = true;
+    return true;
+}
+
 /*
  * Expand:
  * hash = 110110, idx = 6(0110), cap = 16(10000), new_cap = 32(100000)
@@ -106,10 +416,10 @@ int _hashmap_cul_index(uint cap, int h) {
 void _hashmap_rehash(const hashmap map, hash_map_entry *new_bucket, bool is_expand) {
     hash_map_entry *b = map->bucket;
     hash_map_entry  e, ne;
-    int             new_idx;
+    size_t          new_idx;
 
-    uint new_cap = is_expand ? map->cap << 1 : map->cap >> 1;
-    for (int i = 0; i < map->cap; i++, b++) {
+    size_t new_cap = is_expand ? map->cap << 1 : map->cap >> 1;
+    for (size_t i = 0; i < map->cap; i++, b++) {
         if ((e = *b) == NULL) continue;
 
         while (e != NULL) {
@@ -127,26 +437,138 @@ void _hashmap_rehash(const hashmap map, hash_map_entry *new_bucket, bool is_expa
         }
     }
 
-    free(map->bucket);
+    _hashmap_bucket_free(map->alloc_mode, map->bucket, map->cap);
+    map->cap = new_cap;
+    map->bucket = new_bucket;
+}
+
+/*
+ * Resize a mapped bucket array by mremap, so the old and new array are never resident together.
+ * Expand splits bucket i into i and i + cap in place, shrink merges bucket i + new_cap into i before unmapping the
+ * tail.
+ * Return false if not mapped or mremap fails, then caller should fall back to _hashmap_rehash.
+ */
+bool _hashmap_resize_in_place(const hashmap map, size_t new_cap) {
+    size_t old_size = map->cap * sizeof(hash_map_entry);
+    size_t new_size = new_cap * sizeof(hash_map_entry);
+    if (!_hashmap_use_mmap(map->alloc_mode, old_size) || !_hashmap_use_mmap(map->alloc_mode, new_size)) return false;
+    // arrays smaller than HUGE_PAGE_SIZE are mapped by small pages, rehash when crossing it.
+    if ((old_size < HUGE_PAGE_SIZE) != (new_size < HUGE_PAGE_SIZE)) return false;
+
+    old_size = _hashmap_mapped_size(old_size);
+    new_size = _hashmap_mapped_size(new_size);
+    hash_map_entry  e, ne;
+    hash_map_entry *lo, *hi;
+
+    if (new_cap > map->cap) {
+        // pages grown by mremap are zero-filled.
+        void *p = mremap(map->bucket, old_size, new_size, MREMAP_MAYMOVE);
+        if (p == MAP_FAILED) return false;
+        map->bucket = (hash_map_entry *)p;
+
+        for (size_t i = 0; i < map->cap; i++) {
+            e = map->bucket[i];
+            lo = &map->bucket[i];
+            hi = &map->bucket[i + map->cap];
+            while (e != NULL) {
+                ne = e->next;
+                if (e->hash & map->cap) {
+                    *hi = e;
+                    hi = &e->next;
+                } else {
+                    *lo = e;
+                    lo = &e->next;
+                }
+                e = ne;
+            }
+            *lo = *hi = NULL;
+        }
+    } else {
+        for (size_t i = 0; i < new_cap; i++) {
+            if (map->bucket[i + new_cap] == NULL) continue;
+
+            lo = &map->bucket[i];
+            while (*lo != NULL) lo = &(*lo)->next;
+            *lo = map->bucket[i + new_cap];
+        }
+
+        if (mremap(map->bucket, old_size, new_size, 0) == MAP_FAILED)
+            munmap((char *)map->bucket + new_size, old_size - new_size);
+    }
+
+    map->cap = new_cap;
+    return true;
+}
+
+// rehash to any power of 2 capacity, indexes are computed from stored hashes.
+void _hashmap_rehash_to(const hashmap map, hash_map_entry *new_bucket, size_t new_cap) {
+    hash_map_entry *b = map->bucket;
+    hash_map_entry  e, ne;
+    size_t          new_idx;
+
+    for (size_t i = 0; i < map->cap; i++, b++) {
+        for (e = *b; e != NULL; e = ne) {
+            ne = e->next;
+            new_idx = _hashmap_cul_index(new_cap, e->hash);
+            e->next = new_bucket[new_idx];
+            new_bucket[new_idx] = e;
+        }
+    }
+
+    _hashmap_bucket_free(map->alloc_mode, map->bucket, map->cap);
     map->cap = new_cap;
     map->bucket = new_bucket;
 }
 
+bool hashmap_reserve(const hashmap map, size_t size) {
+    if (map->read_only) {
+        perror("hashmap is read only");
+        return false;
+    }
+    _hashmap_cow_reap(map);
+
+    size_t cap = map->cap;
+    while (cap < HASHMAP_MAX_CAP && size >= map->expand_factor * cap) cap <<= 1;
+    if (cap == map->cap) return true;
+
+    if (!_hashmap_cow_own_all(map)) return false;
+    if (map->dense != NULL && _hashmap_dense_cap(map, cap) > map->dense_cap)
+        return _hashmap_dense_resize(map, cap, _hashmap_dense_cap(map, cap));
+    hash_map_entry *new_bucket = _hashmap_bucket_alloc(map->alloc_mode, cap);
+    if (new_bucket == NULL) {
+        perror("no enough memory");
+        return false;
+    }
+
+    _hashmap_rehash_to(map, new_bucket, cap);
+    return true;
+}
+
 // inc_size == 0 means shrink.
-bool _hashmap_ensure_cap(const hashmap map, int inc_size) {
-    if (map->size + inc_size > INT_MAX) {
-        perror("reach the max capacity of hash map");
+bool _hashmap_ensure_cap(const hashmap map, size_t inc_size) {
+    if (inc_size > SIZE_MAX - map->size) {
+        perror("reach the max size of hash map");
         return false;
     }
 
     bool is_expand;
-    if (!inc_size && map->size <= map->shrink_factor * map->cap) is_expand = false;
-    else if (map->cap != INT_MAX && inc_size > 0 && map->size + inc_size >= map->expand_factor * map->cap)
+    // never shrink below the default capacity, halving a single bucket would leave none.
+    if (!inc_size && map->cap > DEFAULT_INIT_CAP && map->size <= map->shrink_factor * map->cap) is_expand = false;
+    else if (map->cap < HASHMAP_MAX_CAP && inc_size > 0 && map->size + inc_size >= map->expand_factor * map->cap)
         is_expand = true;
     else return true;
 
-    hash_map_entry *new_bucket = is_expand ? (hash_map_entry *)calloc(map->cap << 1, sizeof(hash_map_entry))
-                                           : (hash_map_entry *)calloc(map->cap >> 1, sizeof(hash_map_entry));
+    // rehash relinks every entry, none of them could be shared with snapshot.
+    if (!_hashmap_cow_own_all(map)) return false;
+
+    // dense storage is kept on shrink, and grows on expand if needed, relinking the moved entries instead of rehash.
+    size_t dense_cap = _hashmap_dense_cap(map, map->cap << 1);
+    if (is_expand && map->dense != NULL && dense_cap > map->dense_cap)
+        return _hashmap_dense_resize(map, map->cap << 1, dense_cap);
+
+    if (_hashmap_resize_in_place(map, is_expand ? map->cap << 1 : map->cap >> 1)) return true;
+
+    hash_map_entry *new_bucket = _hashmap_bucket_alloc(map->alloc_mode, is_expand ? map->cap << 1 : map->cap >> 1);
 
     if (new_bucket == NULL) goto error;
 
@@ -158,16 +580,93 @@ error:
     return false;
 }
 
-hash_map_entry _hashmap_get_entry(const hashmap map, void *ele) {
-    int h = hash(map->hash_f, map->k_get_f(ele));
-    int idx = _hashmap_cul_index(map->cap, h);
+// true if e's key equals the probe key k of hash h, len is k's length if map interns keys.
+bool _hashmap_key_match(const hashmap map, hash_map_entry e, void *k, size_t h, size_t len) {
+    if (e->hash != h) return false;
+    if (map->key_len_f != NULL) return e->key_len == len && memcmp(e->key, k, len) == 0;
+    return map->k_eq_f(e->key, k);
+}
 
-    hash_map_entry e = map->bucket[idx];
-    while (e != NULL) {
-        if (map->k_eq_f(map->k_get_f(e->ele), map->k_get_f(ele))) return e;
+/*
+ * Find entry by the probe key k and its hash h, k_eq_f is only called when the stored hash equals.
+ * Set pe to the previous entry in bucket if it's not NULL.
+ */
+hash_map_entry _hashmap_find_entry(const hashmap map, void *k, size_t h, hash_map_entry *pe) {
+    hash_map_entry p = NULL;
+    hash_map_entry e = map->bucket[_hashmap_cul_index(map->cap, h)];
+    size_t         len = map->key_len_f != NULL ? map->key_len_f(k) : 0;
+    while (e != NULL && !_hashmap_key_match(map, e, k, h, len)) {
+        p = e;
         e = e->next;
     }
-    return NULL;
+    if (pe != NULL) *pe = p;
+    return e;
+}
+
+hash_map_entry _hashmap_get_entry(const hashmap map, void *ele) {
+    void *k = map->k_get_f(ele);
+    return _hashmap_find_entry(map, k, hash(map->hash_f, k), NULL);
+}
+
+void hashmap_lookup_begin(const hashmap map, hashmap_lookup *l, void *ele) {
+    l->k = map->k_get_f(ele);
+    l->h = hash(map->hash_f, l->k);
+    l->len = map->key_len_f != NULL ? map->key_len_f(l->k) : 0;
+    l->slot = map->bucket + _hashmap_cul_index(map->cap, l->h);
+    l->e = NULL;
+    l->val = NULL;
+    l->state = HASHMAP_LOOKUP_BUCKET;
+    __builtin_prefetch(l->slot);
+}
+
+// move to e, prefetch it if there is one.
+bool _hashmap_lookup_next(hashmap_lookup *l, hash_map_entry e) {
+    l->e = e;
+    if (e == NULL) {
+        l->state = HASHMAP_LOOKUP_DONE;
+        return true;
+    }
+    l->state = HASHMAP_LOOKUP_CHAIN;
+    __builtin_prefetch(e);
+    return false;
+}
+
+bool hashmap_lookup_step(const hashmap map, hashmap_lookup *l) {
+    hash_map_entry e = l->e;
+    switch (l->state) {
+        case HASHMAP_LOOKUP_BUCKET:
+            return _hashmap_lookup_next(l, *l->slot);
+        case HASHMAP_LOOKUP_CHAIN:
+            // only the stored hash is read here, the key is prefetched for the next step if the hash equals.
+            if (e->hash != l->h) return _hashmap_lookup_next(l, e->next);
+            l->state = HASHMAP_LOOKUP_KEY;
+            __builtin_prefetch(e->key);
+            return false;
+        case HASHMAP_LOOKUP_KEY:
+            if (!_hashmap_key_match(map, e, l->k, l->h, l->len)) return _hashmap_lookup_next(l, e->next);
+            l->val = map->v_get_f(e->ele);
+            l->state = HASHMAP_LOOKUP_DONE;
+            return true;
+        default:
+            return true;
+    }
+}
+
+void hashmap_get_batch(const hashmap map, void **eles, void **vals, size_t cnt) {
+    void  *ks[HASHMAP_LOOKUP_BATCH];
+    size_t hs[HASHMAP_LOOKUP_BATCH];
+    for (size_t i = 0; i < cnt; i += HASHMAP_LOOKUP_BATCH) {
+        size_t n = cnt - i < HASHMAP_LOOKUP_BATCH ? cnt - i : HASHMAP_LOOKUP_BATCH;
+        for (size_t j = 0; j < n; j++) {
+            ks[j] = map->k_get_f(eles[i + j]);
+            hs[j] = hash(map->hash_f, ks[j]);
+            __builtin_prefetch(map->bucket + _hashmap_cul_index(map->cap, hs[j]));
+        }
+        for (size_t j = 0; j < n; j++) {
+            hash_map_entry e = _hashmap_find_entry(map, ks[j], hs[j], NULL);
+            vals[i + j] = e == NULL ? NULL : map->v_get_f(e->ele);
+        }
+    }
 }
 
 bool hashmap_contains_key(const hashmap map, void *ele) {
@@ -175,12 +674,20 @@ bool hashmap_contains_key(const hashmap map, void *ele) {
 }
 
 bool hashmap_contains_value(const hashmap map, void *ele) {
+    void           *v = map->v_get_f(ele);
     hash_map_entry *b = map->bucket;
     hash_map_entry  e;
-    for (int i = 0; i < map->cap; i++, b++) {
+    if (map->dense != NULL) {
+        for (size_t i = 0; i < map->dense_len; i++) {
+            if (map->v_eq_f(map->v_get_f(_hashmap_dense_at(map, i)->ele), v)) return true;
+        }
+        return false;
+    }
+
+    for (size_t i = 0; i < map->cap; i++, b++) {
         if ((e = *b) == NULL) continue;
         while (e != NULL) {
-            if (map->v_eq_f(map->v_get_f(e->ele), map->v_get_f(ele))) return true;
+            if (map->v_eq_f(map->v_get_f(e->ele), v)) return true;
             e = e->next;
         }
     }
@@ -188,15 +695,8 @@ bool hashmap_contains_value(const hashmap map, void *ele) {
 }
 
 void *hashmap_get(const hashmap map, void *ele) {
-    int h = hash(map->hash_f, map->k_get_f(ele));
-    int idx = _hashmap_cul_index(map->cap, h);
-
-    hash_map_entry e = map->bucket[idx];
-    while (e != NULL) {
-        if (map->k_eq_f(map->k_get_f(e->ele), map->k_get_f(ele))) return map->v_get_f(e->ele);
-        e = e->next;
-    }
-    return NULL;
+    hash_map_entry e = _hashmap_get_entry(map, ele);
+    return e == NULL ? NULL : map->v_get_f(e->ele);
 }
 
 void *hashmap_get_or_default(const hashmap map, void *ele, void *def_ele) {
@@ -212,42 +712,57 @@ void *hashmap_get_or_default_f(const hashmap map, void *ele, produce_func produc
 }
 
 void *hashmap_put_f(const hashmap map, void *ele, free_func free_f) {
-    hash_map_entry e = (hash_map_entry)malloc(sizeof(struct _hash_map_entry));
-    if (e == NULL) {
-        perror("no enough memory");
-        return map->v_get_f(ele);
+    if (map->read_only) {
+        perror("hashmap is read only");
+        return NULL;
     }
-    e->hash = hash(map->hash_f, map->k_get_f(ele));
-    e->ele = ele;
-    e->next = NULL;
-    e->free_f = free_f;
-
-    if (!_hashmap_ensure_cap(map, 1)) return ele;
-
-    int idx = _hashmap_cul_index(map->cap, e->hash);
-    if (map->bucket[idx] == NULL) {
-        map->bucket[idx] = e;
-        map->size += 1;
+    _hashmap_cow_reap(map);
+
+    void  *k = map->k_get_f(ele);
+    size_t h = hash(map->hash_f, k);
+    // find if key exists, entry is allocated only for a new key.
+    hash_map_entry e = _hashmap_find_entry(map, k, h, NULL);
+    if (e != NULL) {
+        map->v_update_f(e->ele, ele);
+        if (map->log != NULL) _hashmap_log_append(map->log, LOG_OP_PUT, ele);
         return map->v_get_f(e->ele);
     }
 
-    // find if key exists
-    hash_map_entry h = map->bucket[idx];
-    while (h != NULL) {
-        if (map->k_eq_f(map->k_get_f(h->ele), map->k_get_f(ele))) {
-            map->v_update_f(h->ele, ele);
-            return map->v_get_f(h->ele);
-        }
-        h = h->next;
-    }
+    if (!_hashmap_ensure_cap(map, 1)) return map->v_get_f(ele);
+    if ((e = _hashmap_entry_new(map, ele, k, h, free_f)) == NULL) return map->v_get_f(ele);
+
     // key not exists, use head-insert
+    size_t idx = _hashmap_cul_index(map->cap, h);
     e->next = map->bucket[idx];
     map->bucket[idx] = e;
     map->size += 1;
+    if (map->log != NULL) _hashmap_log_append(map->log, LOG_OP_PUT, ele);
 
     return map->v_get_f(e->ele);
 }
 
+hash_map_entry _hashmap_insert_entry(const hashmap map,
+                                     void         *ele,
+                                     void         *k,
+                                     size_t        h,
+                                     free_func     free_f,
+                                     bool         *inserted) {
+    _hashmap_cow_reap(map);
+    *inserted = false;
+    hash_map_entry e = _hashmap_find_entry(map, k, h, NULL);
+    if (e != NULL) return e;
+
+    if (!_hashmap_ensure_cap(map, 1)) return NULL;
+    if ((e = _hashmap_entry_new(map, ele, k, h, free_f)) == NULL) return NULL;
+
+    size_t idx = _hashmap_cul_index(map->cap, h);
+    e->next = map->bucket[idx];
+    map->bucket[idx] = e;
+    map->size += 1;
+    *inserted = true;
+    return e;
+}
+
 void *hashmap_put(const hashmap map, void *ele) {
     return hashmap_put_f(map, ele, NULL);
 }
@@ -265,67 +780,168 @@ void *hashmap_put_if_absent_f(const hashmap map, void *ele, produce_func produce
 }
 
 bool hashmap_ele_set_free_func(const hashmap map, void *ele, free_func free_f) {
-    int h = hash(map->hash_f, ele);
-    int idx = _hashmap_cul_index(map->cap, h);
+    if (map->read_only) {
+        perror("hashmap is read only");
+        return false;
+    }
 
-    hash_map_entry e = map->bucket[idx];
-    while (e != NULL) {
-        if (map->k_eq_f(map->k_get_f(e->ele), map->k_get_f(ele))) {
-            e->free_f = free_f;
-            return true;
-        }
-        e = e->next;
+    void  *k = map->k_get_f(ele);
+    size_t h = hash(map->hash_f, k);
+    if (!_hashmap_cow_own_bucket(map, _hashmap_cul_index(map->cap, h))) return false;
+
+    hash_map_entry e = _hashmap_find_entry(map, k, h, NULL);
+    if (e == NULL) return false;
+    e->free_f = free_f;
+    return true;
+}
+
+bool hashmap_intern_keys(const hashmap map, key_len_func key_len_f) {
+    if (!map->read_only) _hashmap_cow_reap(map);
+    if (map->read_only || map->cow != NULL || map->size > 0 || key_len_f == NULL) {
+        perror("hashmap is read only, not empty, or argument key_len_f is null");
+        return false;
+    }
+
+    map->key_len_f = key_len_f;
+    // entries get larger, so does the stride of dense storage.
+    if (map->dense != NULL && !_hashmap_dense_resize(map, map->cap, map->dense_cap)) {
+        map->key_len_f = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool hashmap_set_dense(const hashmap map) {
+    if (!map->read_only) _hashmap_cow_reap(map);
+    if (map->read_only || map->cow != NULL || map->size > 0) {
+        perror("hashmap is read only, not empty, or has a snapshot");
+        return false;
+    }
+    if (map->dense != NULL) return true;
+
+    size_t dense_cap = _hashmap_dense_cap(map, map->cap);
+    if ((map->dense = (char *)malloc(dense_cap * _hashmap_entry_size(map))) == NULL) {
+        perror("no enough memory");
+        return false;
+    }
+    map->dense_len = 0;
+    map->dense_cap = dense_cap;
+    return true;
+}
+
+// free space of entry itself and its interned key, without calling free_func.
+void _free_entry_space(const hashmap map, hash_map_entry e) {
+    _hashmap_key_release(e);
+    if (map->dense != NULL) {
+        _hashmap_dense_remove(map, e);
+        return;
+    }
+
+    hashmap_slab slab = map->slab;
+    char        *p = (char *)e;
+    if (slab == NULL || p < slab->entries || p >= slab->entries + slab->cap * slab->entry_size) {
+        free(e);
+        return;
+    }
+
+    if (--slab->live == 0) {
+        _hashmap_slab_free(slab);
+        map->slab = NULL;
     }
-    return false;
 }
 
 void _free_entry(const hashmap map, hash_map_entry e) {
     free_func free_f = e->free_f == NULL ? map->free_f : e->free_f;
     if (free_f != NULL) free_f(e->ele);
-    free(e);
+    _free_entry_space(map, e);
     e = NULL;
 }
 
+// free the removed entry, or defer it until snapshot is released.
+void _hashmap_drop_entry(const hashmap map, hash_map_entry e) {
+    if (map->cow == NULL) {
+        _free_entry(map, e);
+        return;
+    }
+
+    e->next = map->cow->pending;
+    map->cow->pending = e;
+}
+
 void *hashmap_remove(const hashmap map, void *ele) {
-    int h = hash(map->hash_f, map->k_get_f(ele));
-    int idx = _hashmap_cul_index(map->cap, h);
+    if (map->read_only) {
+        perror("hashmap is read only");
+        return NULL;
+    }
 
-    hash_map_entry e = map->bucket[idx];
-    hash_map_entry pe = NULL;
-    while (e != NULL) {
-        if (map->k_eq_f(map->k_get_f(e->ele), map->k_get_f(ele))) {
-            if (pe == NULL) map->bucket[idx] = e->next;
-            else pe->next = e->next;
+    void *k = map->k_get_f(ele);
+    if (!_hashmap_remove_entry(map, k, hash(map->hash_f, k))) return NULL;
+    return map->v_get_f(ele);
+}
 
-            void *v = map->v_get_f(ele);
-            _free_entry(map, e);
-            map->size -= 1;
+bool _hashmap_remove_entry(const hashmap map, void *k, size_t h) {
+    _hashmap_cow_reap(map);
+    size_t idx = _hashmap_cul_index(map->cap, h);
+    if (!_hashmap_cow_own_bucket(map, idx)) return false;
 
-            _hashmap_ensure_cap(map, 0);
-            return v;
-        }
-        pe = e;
-        e = e->next;
-    }
+    hash_map_entry pe;
+    hash_map_entry e = _hashmap_find_entry(map, k, h, &pe);
+    if (e == NULL) return false;
 
-    return NULL;
+    if (pe == NULL) map->bucket[idx] = e->next;
+    else pe->next = e->next;
+
+    if (map->log != NULL) _hashmap_log_append(map->log, LOG_OP_REMOVE, e->ele);
+    _hashmap_drop_entry(map, e);
+    map->size -= 1;
+
+    _hashmap_ensure_cap(map, 0);
+    return true;
 }
 
-uint hashmap_remove_if(const hashmap map, filter_func filter_f) {
-    uint            cnt = 0;
+size_t hashmap_remove_if(const hashmap map, filter_func filter_f) {
+    if (map->read_only) {
+        perror("hashmap is read only");
+        return 0;
+    }
+    _hashmap_cow_reap(map);
+
+    size_t          cnt = 0;
     hash_map_entry *b = map->bucket;
-    hash_map_entry  pe = NULL, e;
+    hash_map_entry  pe, e, ne;
+
+    // sweep backwards, so the last entry moved into a removed one's place has been visited.
+    for (size_t i = map->dense_len; i-- > 0;) {
+        if (!filter_f((e = _hashmap_dense_at(map, i))->ele)) continue;
+
+        _hashmap_dense_unlink(map, e);
+        if (map->log != NULL) _hashmap_log_append(map->log, LOG_OP_REMOVE, e->ele);
+        _hashmap_drop_entry(map, e);
+        map->size -= 1;
+        cnt++;
+    }
 
-    for (int i = 0; i < map->cap; i++, b++) {
+    for (size_t i = 0; map->dense == NULL && i < map->cap; i++, b++) {
         if ((e = *b) == NULL) continue;
 
+        pe = NULL;
         while (e != NULL) {
             if (filter_f(e->ele)) {
+                // copy shared entries on the first hit only, then walk the bucket again.
+                if (_hashmap_cow_is_shared(map, i)) {
+                    if (!_hashmap_cow_own_bucket(map, i)) break;
+                    pe = NULL;
+                    e = *b;
+                    continue;
+                }
+
                 if (pe == NULL) map->bucket[i] = e->next;
                 else pe->next = e->next;
 
-                _free_entry(map, e);
-                e = e->next;
+                ne = e->next;
+                if (map->log != NULL) _hashmap_log_append(map->log, LOG_OP_REMOVE, e->ele);
+                _hashmap_drop_entry(map, e);
+                e = ne;
                 map->size -= 1;
                 cnt++;
                 continue;
@@ -339,35 +955,566 @@ uint hashmap_remove_if(const hashmap map, filter_func filter_f) {
     return cnt;
 }
 
-void hashmap_clear(const hashmap map) {
+size_t _hashmap_retain(const hashmap map, const hashmap other, bool keep_present) {
+    _hashmap_cow_reap(map);
+    bool            same_hash = map->hash_f == other->hash_f;
+    size_t          cnt = 0;
     hash_map_entry *b = map->bucket;
-    hash_map_entry  e, ne;
-    for (int i = 0; i < map->cap; i++, b++) {
+    hash_map_entry  pe, e, ne;
+
+    for (size_t i = map->dense_len; i-- > 0;) {
+        e = _hashmap_dense_at(map, i);
+        size_t h = same_hash ? e->hash : hash(other->hash_f, e->key);
+        if ((_hashmap_find_entry(other, e->key, h, NULL) != NULL) == keep_present) continue;
+
+        _hashmap_dense_unlink(map, e);
+        if (map->log != NULL) _hashmap_log_append(map->log, LOG_OP_REMOVE, e->ele);
+        _hashmap_drop_entry(map, e);
+        map->size -= 1;
+        cnt++;
+    }
+
+    for (size_t i = 0; map->dense == NULL && i < map->cap; i++, b++) {
         if ((e = *b) == NULL) continue;
 
+        pe = NULL;
         while (e != NULL) {
+            size_t h = same_hash ? e->hash : hash(other->hash_f, e->key);
+            if ((_hashmap_find_entry(other, e->key, h, NULL) != NULL) == keep_present) {
+                pe = e;
+                e = e->next;
+                continue;
+            }
+
+            if (_hashmap_cow_is_shared(map, i)) {
+                if (!_hashmap_cow_own_bucket(map, i)) break;
+                pe = NULL;
+                e = *b;
+                continue;
+            }
+
+            if (pe == NULL) *b = e->next;
+            else pe->next = e->next;
+
             ne = e->next;
-            _free_entry(map, e);
+            if (map->log != NULL) _hashmap_log_append(map->log, LOG_OP_REMOVE, e->ele);
+            _hashmap_drop_entry(map, e);
             e = ne;
+            map->size -= 1;
+            cnt++;
         }
+    }
+
+    _hashmap_ensure_cap(map, 0);
+    return cnt;
+}
+
+/*
+ * A slice of buckets handled by one thread of the pairwise operations.
+ * For merge, slices are taken from the map with less buckets, so each bucket of dst is only written by one task.
+ */
+typedef struct _hashmap_pair_task {
+    hashmap         dst;
+    hashmap         src;
+    val_update_func merge_f;
+    bool            keep_present;
+    size_t          lo;
+    size_t          hi;
+    size_t          cnt;
+    // entries unlinked by retain, freed by caller thread after all tasks finished.
+    hash_map_entry  removed;
+} hashmap_pair_task;
+
+void _hashmap_merge_one(hashmap_pair_task *task, hash_map_entry e) {
+    hashmap        dst = task->dst;
+    hash_map_entry de = _hashmap_find_entry(dst, e->key, e->hash, NULL);
+    if (de != NULL) {
+        task->merge_f(de->ele, e->ele);
+        // log the merged ele, replaying it by put gives the same value.
+        if (dst->log != NULL) _hashmap_log_append(dst->log, LOG_OP_PUT, de->ele);
+        return;
+    }
+
+    // interned keys of src are freed along with it, dst should refer to the key of ele instead.
+    void *k = task->src->key_len_f == NULL ? e->key : dst->k_get_f(e->ele);
+    if ((de = _hashmap_entry_new(dst, e->ele, k, e->hash, NULL)) == NULL) return;
+
+    size_t idx = _hashmap_cul_index(dst->cap, e->hash);
+    de->next = dst->bucket[idx];
+    dst->bucket[idx] = de;
+    task->cnt++;
+    if (dst->log != NULL) _hashmap_log_append(dst->log, LOG_OP_PUT, de->ele);
+}
+
+// maps share hash_func, dst has enough capacity and its size is updated by caller.
+void *_hashmap_merge_range(void *arg) {
+    hashmap_pair_task *task = (hashmap_pair_task *)arg;
+    hashmap            dst = task->dst, src = task->src;
+    hash_map_entry     e;
+
+    if (dst->cap >= src->cap) {
+        // entries of src bucket i can only go to dst buckets i + k * src->cap.
+        for (size_t i = task->lo; i < task->hi; i++) {
+            for (e = src->bucket[i]; e != NULL; e = e->next) _hashmap_merge_one(task, e);
+        }
+        return NULL;
+    }
+
+    // dst bucket i only receives entries from src buckets i + k * dst->cap.
+    for (size_t i = task->lo; i < task->hi; i++) {
+        for (size_t j = i; j < src->cap; j += dst->cap) {
+            for (e = src->bucket[j]; e != NULL; e = e->next) _hashmap_merge_one(task, e);
+        }
+    }
+    return NULL;
+}
+
+// dst has no snapshot, its size is updated and removed entries are freed by caller.
+void *_hashmap_retain_range(void *arg) {
+    hashmap_pair_task *task = (hashmap_pair_task *)arg;
+    hashmap            dst = task->dst, other = task->src;
+    bool               same_hash = dst->hash_f == other->hash_f;
+    hash_map_entry    *link, e;
+
+    for (size_t i = task->lo; i < task->hi; i++) {
+        link = &dst->bucket[i];
+        while ((e = *link) != NULL) {
+            size_t h = same_hash ? e->hash : hash(other->hash_f, e->key);
+            if ((_hashmap_find_entry(other, e->key, h, NULL) != NULL) == task->keep_present) {
+                link = &e->next;
+                continue;
+            }
+
+            *link = e->next;
+            e->next = task->removed;
+            task->removed = e;
+            task->cnt++;
+        }
+    }
+    return NULL;
+}
+
+// split [0, range) to thread_cnt tasks and run f on them, return sum of task counts and collect removed entries.
+size_t _hashmap_run_pair_tasks(hashmap_pair_task *proto, size_t range, int thread_cnt, void *(*f)(void *)) {
+    // clamp before comparing with range, a negative thread_cnt would be converted to a huge size_t.
+    if (thread_cnt < 1) thread_cnt = 1;
+    if ((size_t)thread_cnt > range) thread_cnt = (int)range;
+    if (thread_cnt <= 1) {
+        proto->lo = 0;
+        proto->hi = range;
+        f(proto);
+        return proto->cnt;
+    }
+
+    hashmap_pair_task *tasks = (hashmap_pair_task *)calloc(thread_cnt, sizeof(hashmap_pair_task));
+    pthread_t         *tids = (pthread_t *)calloc(thread_cnt, sizeof(pthread_t));
+    bool              *started = (bool *)calloc(thread_cnt, sizeof(bool));
+    if (tasks == NULL || tids == NULL || started == NULL) {
+        free(tasks);
+        free(tids);
+        free(started);
+        return _hashmap_run_pair_tasks(proto, range, 1, f);
+    }
+
+    size_t step = (range + thread_cnt - 1) / thread_cnt, cnt = 0;
+    for (int t = 0; t < thread_cnt; t++) {
+        tasks[t] = *proto;
+        tasks[t].lo = t * step > range ? range : t * step;
+        tasks[t].hi = (t + 1) * step > range ? range : (t + 1) * step;
+        // run in caller thread if a thread could not be created.
+        started[t] = pthread_create(&tids[t], NULL, f, &tasks[t]) == 0;
+        if (!started[t]) f(&tasks[t]);
+    }
+    hash_map_entry e;
+    for (int t = 0; t < thread_cnt; t++) {
+        if (started[t]) pthread_join(tids[t], NULL);
+        cnt += tasks[t].cnt;
+        while ((e = tasks[t].removed) != NULL) {
+            tasks[t].removed = e->next;
+            e->next = proto->removed;
+            proto->removed = e;
+        }
+    }
+
+    free(tasks);
+    free(tids);
+    free(started);
+    return cnt;
+}
+
+size_t hashmap_merge_into(const hashmap dst, const hashmap src, val_update_func merge_f, int thread_cnt) {
+    if (dst->read_only) {
+        perror("hashmap is read only");
+        return 0;
+    }
+    if (merge_f == NULL) merge_f = dst->v_update_f;
+    _hashmap_cow_reap(dst);
+
+    // no rehash while merging, so buckets can be split among threads.
+    if (!hashmap_reserve(dst, dst->size + src->size)) return 0;
+
+    hashmap_pair_task task = {dst, src, merge_f, false, 0, 0, 0, NULL};
+    size_t            cnt = 0;
+    if (dst->hash_f == src->hash_f) {
+        size_t range = dst->cap >= src->cap ? src->cap : dst->cap;
+        // key chunks and dense storage of dst are not thread safe.
+        bool shared_alloc = dst->key_len_f != NULL || dst->dense != NULL;
+        cnt = _hashmap_run_pair_tasks(&task, range, shared_alloc ? 1 : thread_cnt, &_hashmap_merge_range);
+    } else {
+        // hashes must be computed again, walk src sequentially.
+        struct _hash_map_entry probe;
+        for (size_t i = 0; i < src->cap; i++) {
+            for (hash_map_entry e = src->bucket[i]; e != NULL; e = e->next) {
+                probe = *e;
+                probe.hash = hash(dst->hash_f, e->key);
+                _hashmap_merge_one(&task, &probe);
+            }
+        }
+        cnt = task.cnt;
+    }
+
+    dst->size += cnt;
+    return cnt;
+}
+
+size_t _hashmap_retain_parallel(const hashmap dst, const hashmap other, bool keep_present, int thread_cnt) {
+    if (dst->read_only) {
+        perror("hashmap is read only");
+        return 0;
+    }
+    _hashmap_cow_reap(dst);
+    // entries removed from a snapshotted map go to the shared pending list, keep it single threaded.
+    if (thread_cnt <= 1 || dst->cow != NULL || dst->dense != NULL) return _hashmap_retain(dst, other, keep_present);
+
+    hashmap_pair_task task = {dst, other, NULL, keep_present, 0, 0, 0, NULL};
+    size_t            cnt = _hashmap_run_pair_tasks(&task, dst->cap, thread_cnt, &_hashmap_retain_range);
+    hash_map_entry    e;
+    while ((e = task.removed) != NULL) {
+        task.removed = e->next;
+        if (dst->log != NULL) _hashmap_log_append(dst->log, LOG_OP_REMOVE, e->ele);
+        _free_entry(dst, e);
+    }
+    dst->size -= cnt;
+    _hashmap_ensure_cap(dst, 0);
+    return cnt;
+}
+
+size_t hashmap_intersect(const hashmap dst, const hashmap other, int thread_cnt) {
+    return _hashmap_retain_parallel(dst, other, true, thread_cnt);
+}
+
+size_t hashmap_diff(const hashmap dst, const hashmap other, int thread_cnt) {
+    return _hashmap_retain_parallel(dst, other, false, thread_cnt);
+}
+
+void hashmap_clear(const hashmap map) {
+    if (map->read_only) {
+        perror("hashmap is read only");
+        return;
+    }
+    _hashmap_cow_reap(map);
+
+    if (map->log != NULL) _hashmap_log_append(map->log, LOG_OP_CLEAR, NULL);
+
+    hashmap_cow     cow = map->cow;
+    hash_map_entry *b = map->bucket;
+    hash_map_entry  e, ne, shared;
+    if (map->dense != NULL) {
+        for (size_t i = 0; i < map->dense_len; i++) {
+            e = _hashmap_dense_at(map, i);
+            free_func free_f = e->free_f == NULL ? map->free_f : e->free_f;
+            if (free_f != NULL) free_f(e->ele);
+            _hashmap_key_release(e);
+        }
+        map->dense_len = 0;
+        memset(map->bucket, 0, map->cap * sizeof(hash_map_entry));
+        map->size = 0;
+        return;
+    }
+
+    for (size_t i = 0; i < map->cap; i++, b++) {
+        if ((e = *b) == NULL) continue;
+
+        // entries shared with snapshot are left to it.
+        shared = _hashmap_cow_is_shared(map, i) ? cow->snap->bucket[i] : NULL;
+        while (e != shared) {
+            ne = e->next;
+            _hashmap_drop_entry(map, e);
+            e = ne;
+        }
+        if (shared != NULL) cow->state[i] = COW_DROPPED;
         *b = NULL;
     }
 
     map->size = 0;
 }
 
+// free snapshot and the entries only it refers to, then hand the still shared entries back to the live map.
+void _hashmap_snapshot_release(hashmap snap) {
+    hashmap_cow    cow = snap->cow;
+    hashmap        live = cow->live;
+    hash_map_entry e, ne;
+
+    for (size_t i = 0; i < cow->cap; i++) {
+        if (cow->state[i] == COW_SHARED && live != NULL) continue;
+
+        e = snap->bucket[i];
+        while (e != NULL) {
+            ne = e->next;
+            // eles of owned buckets are still in live map, or in pending if removed.
+            if (cow->state[i] == COW_OWNED) _free_entry_space(snap, e);
+            else _free_entry(snap, e);
+            e = ne;
+        }
+    }
+
+    // pending entries are allocated by live map.
+    hashmap owner = live == NULL ? snap : live;
+    e = cow->pending;
+    while (e != NULL) {
+        ne = e->next;
+        _free_entry(owner, e);
+        e = ne;
+    }
+
+    if (live != NULL) {
+        live->cow = NULL;
+        // the slab is only alive if some of its entries are still shared, live map has no slab then.
+        if (snap->slab != NULL) live->slab = snap->slab;
+    }
+
+    free(cow->state);
+    free(cow);
+    _hashmap_bucket_free(snap->alloc_mode, snap->bucket, snap->cap);
+    free(snap);
+}
+
+void _hashmap_cow_reap(const hashmap map) {
+    if (map->cow != NULL && (__atomic_load_n(&map->cow->detached, __ATOMIC_ACQUIRE) & COW_SNAP_GONE))
+        _hashmap_snapshot_release(map->cow->snap);
+}
+
 void hashmap_free(hashmap map) {
     if (map == NULL) return;
 
+    if (map->read_only) {
+        // the live map may be modified by another thread, it releases the snapshot unless it's already freed.
+        if (__atomic_fetch_or(&map->cow->detached, COW_SNAP_GONE, __ATOMIC_ACQ_REL) & COW_LIVE_GONE)
+            _hashmap_snapshot_release(map);
+        return;
+    }
+
+    // no need to log the entries freed along with map, the writer frees the snapshot of a pending compaction.
+    if (map->log != NULL) hashmap_log_close(map);
+    _hashmap_cow_reap(map);
+
     if (map->bucket != NULL) {
         hashmap_clear(map);
-        free(map->bucket);
+        _hashmap_bucket_free(map->alloc_mode, map->bucket, map->cap);
         map->bucket = NULL;
     }
+    free(map->dense);
+    // keys still shared with snapshot free the chunk when released.
+    _hashmap_key_chunk_seal(map->key_chunk);
+    // snapshot outlives the map, it frees the remained entries when released, or now if freed meanwhile.
+    hashmap_cow cow = map->cow;
+    if (cow != NULL) {
+        cow->live = NULL;
+        if (__atomic_fetch_or(&cow->detached, COW_LIVE_GONE, __ATOMIC_ACQ_REL) & COW_SNAP_GONE)
+            _hashmap_snapshot_release(cow->snap);
+    }
     free(map);
     map = NULL;
 }
 
+hashmap hashmap_snapshot(const hashmap map) {
+    if (!map->read_only) _hashmap_cow_reap(map);
+    // dense entries move on removal, they could not be shared.
+    if (map->read_only || map->cow != NULL || map->dense != NULL) {
+        perror("hashmap is read only, dense or already has a snapshot");
+        return NULL;
+    }
+
+    hashmap         snap = (hashmap)malloc(sizeof(struct _hashmap));
+    hashmap_cow     cow = (hashmap_cow)calloc(1, sizeof(struct _hashmap_cow));
+    unsigned char  *state = (unsigned char *)calloc(map->cap, sizeof(unsigned char));
+    hash_map_entry *bucket = _hashmap_bucket_alloc(map->alloc_mode, map->cap);
+    if (snap == NULL || cow == NULL || state == NULL || bucket == NULL) goto error;
+
+    memcpy(bucket, map->bucket, map->cap * sizeof(hash_map_entry));
+    *snap = *map;
+    snap->bucket = bucket;
+    snap->read_only = true;
+    snap->cow = cow;
+    snap->log = NULL;
+    // entries in slab belong to snapshot until it's released.
+    map->slab = NULL;
+
+    cow->live = map;
+    cow->snap = snap;
+    cow->cap = map->cap;
+    cow->state = state;
+    map->cow = cow;
+    return snap;
+
+error:
+    free(snap);
+    free(cow);
+    free(state);
+    if (bucket != NULL) _hashmap_bucket_free(map->alloc_mode, bucket, map->cap);
+    perror("no enough memory");
+    return NULL;
+}
+
+hashmap hashmap_clone(const hashmap map) {
+    hashmap         clone = (hashmap)malloc(sizeof(struct _hashmap));
+    hash_map_entry *bucket = _hashmap_bucket_alloc(map->alloc_mode, map->cap);
+    hashmap_slab    slab = NULL;
+    size_t          entry_size = _hashmap_entry_size(map);
+    if (map->size > 0) slab = _hashmap_slab_alloc(map->alloc_mode, map->size, entry_size);
+    if (clone == NULL || bucket == NULL || (map->size > 0 && slab == NULL)) goto error;
+
+    *clone = *map;
+    clone->bucket = bucket;
+    clone->slab = slab;
+    clone->read_only = false;
+    clone->cow = NULL;
+    clone->log = NULL;
+    clone->key_chunk = NULL;
+    clone->free_f = NULL;
+    clone->dense = NULL;
+    clone->dense_len = clone->dense_cap = 0;
+
+    // keep the chain order, stored hashes are valid since cap is the same. Interned keys are copied into clone.
+    char           *ne = slab == NULL ? NULL : slab->entries;
+    hash_map_entry *link;
+    for (size_t i = 0; i < map->cap; i++) {
+        link = &bucket[i];
+        for (hash_map_entry e = map->bucket[i]; e != NULL; e = e->next, ne += entry_size) {
+            *(hash_map_entry)ne = *e;
+            if (!_hashmap_entry_set_key(clone, (hash_map_entry)ne, e->key)) goto key_error;
+            ((hash_map_entry)ne)->free_f = NULL;
+            *link = (hash_map_entry)ne;
+            link = &((hash_map_entry)ne)->next;
+        }
+        *link = NULL;
+    }
+    return clone;
+
+key_error:
+    for (char *p = slab->entries; p < ne; p += entry_size) _hashmap_key_release((hash_map_entry)p);
+    _hashmap_key_chunk_seal(clone->key_chunk);
+error:
+    free(clone);
+    if (bucket != NULL) _hashmap_bucket_free(map->alloc_mode, bucket, map->cap);
+    _hashmap_slab_free(slab);
+    perror("no enough memory");
+    return NULL;
+}
+
+// slab holding e, the live map's slab belongs to its snapshot until released.
+hashmap_slab _hashmap_slab_of(const hashmap map, hash_map_entry e) {
+    hashmap_slab slabs[] = {map->slab, map->cow == NULL ? NULL : map->cow->snap->slab};
+    for (int i = 0; i < 2; i++) {
+        hashmap_slab slab = slabs[i];
+        if (slab != NULL && (char *)e >= slab->entries && (char *)e < slab->entries + slab->cap * slab->entry_size)
+            return slab;
+    }
+    return NULL;
+}
+
+// bytes of a mapped or malloced block, malloc adds one size_t header.
+size_t _hashmap_block_size(int alloc_mode, void *p, size_t bytes) {
+    if (_hashmap_use_mmap(alloc_mode, bytes)) return _hashmap_mapped_size(bytes);
+    return malloc_usable_size(p) + sizeof(size_t);
+}
+
+hashmap_mem_usage hashmap_memory_usage(const hashmap map) {
+    hashmap_mem_usage usage = {0};
+    size_t            entry_size = _hashmap_entry_size(map);
+    hashmap_slab      slab;
+
+    usage.bucket = map->cap * sizeof(hash_map_entry);
+    usage.overhead = sizeof(struct _hashmap);
+    usage.overhead += _hashmap_block_size(map->alloc_mode, map->bucket, usage.bucket) - usage.bucket;
+    if (map->cow != NULL && map->cow->live == map) usage.overhead += sizeof(struct _hashmap_cow) + map->cow->cap;
+
+    for (size_t i = 0; i < map->cap; i++) {
+        for (hash_map_entry e = map->bucket[i]; e != NULL; e = e->next) {
+            usage.entry += entry_size;
+            if (map->dense == NULL && _hashmap_slab_of(map, e) == NULL)
+                usage.overhead += malloc_usable_size(e) + sizeof(size_t) - entry_size;
+            if (e->key_len < HASHMAP_INLINE_KEY_SIZE) continue;
+
+            hashmap_key_chunk chunk = _hashmap_key_chunk_of(e);
+            usage.key += (sizeof(struct _hashmap_key_chunk) + chunk->cap) / chunk->live;
+        }
+    }
+    // the chunk being filled is kept even if all of its keys are released.
+    if (map->key_chunk != NULL && map->key_chunk->live == 0)
+        usage.overhead += sizeof(struct _hashmap_key_chunk) + map->key_chunk->cap;
+
+    if (map->dense != NULL) {
+        usage.overhead += malloc_usable_size(map->dense) + sizeof(size_t) - map->dense_len * entry_size;
+    }
+    if ((slab = map->slab) != NULL) {
+        size_t bytes = sizeof(struct _hashmap_slab) + slab->cap * slab->entry_size;
+        usage.overhead += (slab->mapped ? _hashmap_mapped_size(bytes) : malloc_usable_size(slab) + sizeof(size_t));
+        usage.overhead -= slab->live * slab->entry_size;
+    }
+
+    usage.total = usage.bucket + usage.entry + usage.key + usage.overhead;
+    return usage;
+}
+
+// copy entries into one slab in bucket order, long interned keys are shared by the copies.
+bool _hashmap_relocate(const hashmap map) {
+    size_t       entry_size = _hashmap_entry_size(map);
+    hashmap_slab slab = _hashmap_slab_alloc(map->alloc_mode, map->size, entry_size);
+    if (slab == NULL) return false;
+
+    char          *ne = slab->entries;
+    hash_map_entry e;
+    for (size_t i = 0; i < map->cap; i++) {
+        for (hash_map_entry *link = &map->bucket[i]; (e = *link) != NULL; link = &(*link)->next, ne += entry_size) {
+            _hashmap_entry_copy(map, (hash_map_entry)ne, e);
+            *link = (hash_map_entry)ne;
+            // the old slab is freed along with its last entry.
+            _free_entry_space(map, e);
+        }
+    }
+    map->slab = slab;
+    return true;
+}
+
+bool hashmap_compact(const hashmap map) {
+    if (map->read_only) {
+        perror("hashmap is read only");
+        return false;
+    }
+    _hashmap_cow_reap(map);
+
+    size_t cap = DEFAULT_INIT_CAP;
+    while (cap < HASHMAP_MAX_CAP && map->size >= map->expand_factor * cap) cap <<= 1;
+    // dense entries are contiguous already, only trim the storage.
+    if (map->dense != NULL) return _hashmap_dense_resize(map, cap, _hashmap_dense_cap(map, cap));
+    if (cap != map->cap) {
+        if (!_hashmap_cow_own_all(map)) return false;
+        hash_map_entry *new_bucket = _hashmap_bucket_alloc(map->alloc_mode, cap);
+        if (new_bucket == NULL) goto mem_error;
+        _hashmap_rehash_to(map, new_bucket, cap);
+    }
+
+    // the snapshot holds the only slab of both maps until released.
+    if (map->cow != NULL || map->size == 0) return true;
+    if (!_hashmap_relocate(map)) goto mem_error;
+    return true;
+
+mem_error:
+    perror("no enough memory");
+    return false;
+}
+
 hashmap_itr hashmap_itr_new(foreach_func foreach_f) {
     hashmap_itr itr = (hashmap_itr)calloc(1, sizeof(struct _hashmap_iterator));
     if (itr == NULL) goto error;
@@ -393,17 +1540,26 @@ void hashmap_itr_set_foreach_f(const hashmap_itr itr, foreach_func foreach_f) {
     itr->foreach_f = foreach_f;
 }
 
-void hashmap_foreach(const hashmap map, const hashmap_itr itr) {
+bool hashmap_foreach(const hashmap map, const hashmap_itr itr) {
     hash_map_entry *b = map->bucket;
     hash_map_entry  e;
-    for (int i = 0; i < map->cap; i++, b++) {
+    if (map->dense != NULL) {
+        for (size_t i = 0; i < map->dense_len; i++) {
+            e = _hashmap_dense_at(map, i);
+            if ((itr->filter_f == NULL || itr->filter_f(e->ele)) && itr->foreach_f(e->ele)) return true;
+        }
+        return false;
+    }
+
+    for (size_t i = 0; i < map->cap; i++, b++) {
         if ((e = *b) == NULL) continue;
 
         while (e != NULL) {
             if (itr->filter_f == NULL || itr->filter_f(e->ele)) {
-                if (itr->foreach_f(e->ele)) return;
+                if (itr->foreach_f(e->ele)) return true;
                 e = e->next;
             } else e = e->next;
         }
     }
+    return false;
 }
\ No newline at end of file
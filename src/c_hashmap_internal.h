@@ -0,0 +1,38 @@
+#ifndef C_HASH_MAP_INTERNAL_H
+#define C_HASH_MAP_INTERNAL_H
+
+#include "c_hashmap.h"
+
+/*
+ * Internal functions of _hashmap, shared by containers built on the same engine(hashset, hashmultimap).
+ * They skip the read only check of public functions, and take the key k and its hash h computed by caller.
+ */
+
+size_t _hashmap_cul_index(size_t cap, size_t h);
+// inc_size == 0 means shrink.
+bool   _hashmap_ensure_cap(const hashmap map, size_t inc_size);
+
+// find entry of key k with hash h, set pe to the previous entry in bucket if it's not NULL.
+hash_map_entry _hashmap_find_entry(const hashmap map, void *k, size_t h, hash_map_entry *pe);
+// insert ele if key k is absent, return the entry of k, or NULL if no enough memory.
+hash_map_entry _hashmap_insert_entry(const hashmap map,
+                                     void         *ele,
+                                     void         *k,
+                                     size_t        h,
+                                     free_func     free_f,
+                                     bool         *inserted);
+// remove and free the entry of key k, return false if absent.
+bool           _hashmap_remove_entry(const hashmap map, void *k, size_t h);
+/*
+ * Remove entries of map whose keys are absent in other(keep_present), or present in other(!keep_present).
+ * Stored hashes are reused if both maps have the same hash_func. Return removed count.
+ */
+size_t         _hashmap_retain(const hashmap map, const hashmap other, bool keep_present);
+
+// release the snapshot of map if it's been freed, called on entry of operations modifying map.
+void _hashmap_cow_reap(const hashmap map);
+
+// append one record of op on ele to log, ele is ignored by LOG_OP_CLEAR.
+void _hashmap_log_append(struct _hashmap_log *log, int op, void *ele);
+
+#endif
@@ -0,0 +1,426 @@
+#include "c_hashmap_log.h"
+#include "c_hashmap_internal.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// FNV-1a of op and payload, detects records torn by a crash.
+uint32_t _log_checksum(int op, const char *payload, size_t len) {
+    uint32_t h = 2166136261u;
+    h = (h ^ (unsigned char)op) * 16777619u;
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)payload[i]) * 16777619u;
+    return h;
+}
+
+bool _log_buf_reserve(char **buf, size_t *cap, size_t need) {
+    if (need <= *cap) return true;
+
+    size_t new_cap = *cap == 0 ? LOG_INIT_BUF_SIZE : *cap;
+    while (new_cap < need) new_cap <<= 1;
+    char *new_buf = (char *)realloc(*buf, new_cap);
+    if (new_buf == NULL) return false;
+
+    *buf = new_buf;
+    *cap = new_cap;
+    return true;
+}
+
+// append one record to the end of buf.
+bool _log_encode(serialize_func ser_f, char **buf, size_t *len, size_t *cap, int op, void *ele) {
+    if (!_log_buf_reserve(buf, cap, *len + LOG_RECORD_HEADER_SIZE)) return false;
+
+    size_t n = 0;
+    if (op != LOG_OP_CLEAR) {
+        size_t avail = *cap - *len - LOG_RECORD_HEADER_SIZE;
+        n = ser_f(ele, *buf + *len + LOG_RECORD_HEADER_SIZE, avail);
+        if (n > avail) {
+            if (!_log_buf_reserve(buf, cap, *len + LOG_RECORD_HEADER_SIZE + n)) return false;
+            ser_f(ele, *buf + *len + LOG_RECORD_HEADER_SIZE, n);
+        }
+    }
+
+    char    *h = *buf + *len;
+    uint32_t l = (uint32_t)n;
+    uint32_t c = _log_checksum(op, h + LOG_RECORD_HEADER_SIZE, n);
+    h[0] = (char)op;
+    memcpy(h + 1, &l, sizeof(l));
+    memcpy(h + 5, &c, sizeof(c));
+    *len += LOG_RECORD_HEADER_SIZE + n;
+    return true;
+}
+
+/*
+ * Read the record at buf[off], return its length or 0 if it's incomplete or corrupted.
+ */
+size_t _log_decode(const char *buf, size_t len, size_t off, int *op, const char **payload, size_t *payload_len) {
+    if (len - off < LOG_RECORD_HEADER_SIZE) return 0;
+
+    uint32_t l, c;
+    memcpy(&l, buf + off + 1, sizeof(l));
+    memcpy(&c, buf + off + 5, sizeof(c));
+    if (len - off - LOG_RECORD_HEADER_SIZE < l) return 0;
+
+    *op = (unsigned char)buf[off];
+    *payload = buf + off + LOG_RECORD_HEADER_SIZE;
+    *payload_len = l;
+    if (*op < LOG_OP_PUT || *op > LOG_OP_CLEAR || _log_checksum(*op, *payload, l) != c) return 0;
+    return LOG_RECORD_HEADER_SIZE + l;
+}
+
+bool _log_write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+void _hashmap_log_append(struct _hashmap_log *log, int op, void *ele) {
+    pthread_mutex_lock(&log->lock);
+    size_t old_len = log->len;
+    if (_log_encode(log->ser_f, &log->buf, &log->len, &log->cap, op, ele)) {
+        log->appended += log->len - old_len;
+        if (old_len == 0) pthread_cond_signal(&log->wake);
+    } else {
+        log->failed = true;
+        perror("no enough memory");
+    }
+    pthread_mutex_unlock(&log->lock);
+}
+
+// write compacted entries and the records after them to a new file, then replace the log with it.
+bool _hashmap_log_rewrite(hashmap_log log, const char *compact, size_t compact_len, const char *tail, size_t tail_len) {
+    size_t path_len = strlen(log->path);
+    char  *tmp = (char *)malloc(path_len + sizeof(".compact"));
+    if (tmp == NULL) return false;
+    memcpy(tmp, log->path, path_len);
+    memcpy(tmp + path_len, ".compact", sizeof(".compact"));
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        free(tmp);
+        return false;
+    }
+    if (!_log_write_all(fd, compact, compact_len) || !_log_write_all(fd, tail, tail_len) || fdatasync(fd) != 0 ||
+        rename(tmp, log->path) != 0) {
+        close(fd);
+        unlink(tmp);
+        free(tmp);
+        return false;
+    }
+    free(tmp);
+
+    // make the rename durable.
+    char *dir = strdup(log->path);
+    char *slash = dir == NULL ? NULL : strrchr(dir, '/');
+    if (slash != NULL) {
+        *(slash == dir ? slash + 1 : slash) = '\0';
+        int dir_fd = open(dir, O_RDONLY);
+        if (dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+    } else {
+        int dir_fd = open(".", O_RDONLY);
+        if (dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+    }
+    free(dir);
+
+    close(log->fd);
+    log->fd = fd;
+    return true;
+}
+
+// encode all entries of map as put records.
+bool _hashmap_log_serialize(hashmap_log log, const hashmap map, char **buf, size_t *len) {
+    size_t cap = 0;
+    *buf = NULL;
+    *len = 0;
+    for (size_t i = 0; i < map->cap; i++) {
+        for (hash_map_entry e = map->bucket[i]; e != NULL; e = e->next) {
+            if (!_log_encode(log->ser_f, buf, len, &cap, LOG_OP_PUT, e->ele)) {
+                free(*buf);
+                *buf = NULL;
+                perror("no enough memory");
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void *_hashmap_log_writer(void *arg) {
+    hashmap_log log = (hashmap_log)arg;
+
+    pthread_mutex_lock(&log->lock);
+    while (true) {
+        while (!log->stop && log->len == 0 && !log->compact_pending) pthread_cond_wait(&log->wake, &log->lock);
+        if (log->stop && log->len == 0 && !log->compact_pending) break;
+
+        // group commit, wait a moment for more records unless someone is waiting for them.
+        if (!log->stop && log->sync_waiters == 0 && !log->compact_pending) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += LOG_GROUP_COMMIT_US * 1000L;
+            ts.tv_sec += ts.tv_nsec / 1000000000L;
+            ts.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&log->wake, &log->lock, &ts);
+        }
+
+        // swap buffers, so the map thread appends to spare while this batch is written.
+        char    *batch = log->buf;
+        size_t   batch_len = log->len, batch_cap = log->cap;
+        uint64_t target = log->appended;
+        log->buf = log->spare;
+        log->cap = log->spare_cap;
+        log->len = 0;
+        log->spare = NULL;
+        log->spare_cap = 0;
+
+        bool     compact = log->compact_pending;
+        uint64_t compact_seq = log->compact_req;
+        hashmap  compact_snap = log->compact_snap;
+        char    *compact_buf = log->compact_buf;
+        size_t   compact_len = log->compact_len, compact_off = log->compact_off;
+        log->compact_pending = false;
+        log->compact_snap = NULL;
+        log->compact_buf = NULL;
+        pthread_mutex_unlock(&log->lock);
+
+        bool compacted = compact;
+        // the snapshot is released by the map thread on its next modification.
+        if (compact_snap != NULL) {
+            compacted = _hashmap_log_serialize(log, compact_snap, &compact_buf, &compact_len);
+            hashmap_free(compact_snap);
+        }
+        compacted = compacted &&
+                    _hashmap_log_rewrite(log, compact_buf, compact_len, batch + compact_off, batch_len - compact_off);
+        free(compact_buf);
+        // the old log is left intact by a failed compaction, the whole batch still goes to it.
+        bool ok = compacted || (_log_write_all(log->fd, batch, batch_len) && fdatasync(log->fd) == 0);
+
+        pthread_mutex_lock(&log->lock);
+        log->spare = batch;
+        log->spare_cap = batch_cap;
+        if (!ok) {
+            log->failed = true;
+            perror("failed to write hashmap log");
+        }
+        if (compact) {
+            log->compact_done = compact_seq;
+            if (!compacted) {
+                log->compact_failed = true;
+                perror("failed to compact hashmap log");
+            }
+        }
+        log->durable = target;
+        pthread_cond_broadcast(&log->durable_cond);
+    }
+    pthread_mutex_unlock(&log->lock);
+    return NULL;
+}
+
+/*
+ * Replay records into map, a torn record at the end is truncated.
+ * Capacity is reserved for all put records first, so replay does not expand on the way. Put records also count the
+ * updates of one key, so the capacity is shrunk to fit if it turns out far more than needed.
+ */
+bool _hashmap_log_replay(hashmap_log log) {
+    struct stat st;
+    if (fstat(log->fd, &st) != 0) return false;
+    if (st.st_size == 0) return true;
+
+    size_t len = st.st_size;
+    char  *buf = (char *)malloc(len);
+    if (buf == NULL) return false;
+    size_t read_len = 0;
+    while (read_len < len) {
+        ssize_t n = pread(log->fd, buf + read_len, len - read_len, read_len);
+        if (n <= 0) {
+            free(buf);
+            return false;
+        }
+        read_len += n;
+    }
+
+    int         op;
+    const char *payload;
+    size_t      payload_len, rec_len, off = 0, put_cnt = 0;
+    while (off < len && (rec_len = _log_decode(buf, len, off, &op, &payload, &payload_len)) > 0) {
+        if (op == LOG_OP_PUT) put_cnt++;
+        off += rec_len;
+    }
+    if (off < len && ftruncate(log->fd, off) != 0) perror("failed to truncate torn hashmap log");
+    len = off;
+
+    hashmap map = log->map;
+    size_t  cap = map->cap;
+    hashmap_reserve(map, map->size + put_cnt);
+    for (off = 0; off < len; off += rec_len) {
+        rec_len = _log_decode(buf, len, off, &op, &payload, &payload_len);
+        if (op == LOG_OP_CLEAR) {
+            hashmap_clear(map);
+            continue;
+        }
+
+        void *ele = log->de_f(payload, payload_len);
+        if (ele == NULL) continue;
+        // map only takes ele of a new key.
+        if (op == LOG_OP_PUT && !hashmap_contains_key(map, ele)) {
+            hashmap_put(map, ele);
+            continue;
+        }
+        if (op == LOG_OP_PUT) hashmap_put(map, ele);
+        else hashmap_remove(map, ele);
+        if (log->tmp_free_f != NULL) log->tmp_free_f(ele);
+    }
+    if (map->cap > cap && map->size < map->expand_factor * (map->cap >> 1)) hashmap_compact(map);
+
+    free(buf);
+    return true;
+}
+
+hashmap_log hashmap_log_open(const hashmap   map,
+                             const char      *path,
+                             serialize_func   ser_f,
+                             deserialize_func de_f,
+                             free_func        tmp_free_f) {
+    if (map->read_only || map->log != NULL || ser_f == NULL || de_f == NULL) goto arg_error;
+
+    hashmap_log log = (hashmap_log)calloc(1, sizeof(struct _hashmap_log));
+    if (log == NULL) goto mem_error;
+    log->map = map;
+    log->ser_f = ser_f;
+    log->de_f = de_f;
+    log->tmp_free_f = tmp_free_f;
+    log->path = strdup(path);
+    log->buf = (char *)malloc(LOG_INIT_BUF_SIZE);
+    log->spare = (char *)malloc(LOG_INIT_BUF_SIZE);
+    if (log->path == NULL || log->buf == NULL || log->spare == NULL) goto error;
+    log->cap = log->spare_cap = LOG_INIT_BUF_SIZE;
+
+    if ((log->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0) {
+        perror("failed to open hashmap log");
+        goto error;
+    }
+    // map->log is not attached yet, replay is not logged again.
+    if (!_hashmap_log_replay(log)) {
+        perror("failed to replay hashmap log");
+        close(log->fd);
+        goto error;
+    }
+
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->wake, NULL);
+    pthread_cond_init(&log->durable_cond, NULL);
+    if (pthread_create(&log->writer, NULL, &_hashmap_log_writer, log) != 0) {
+        perror("failed to start hashmap log writer");
+        pthread_mutex_destroy(&log->lock);
+        pthread_cond_destroy(&log->wake);
+        pthread_cond_destroy(&log->durable_cond);
+        close(log->fd);
+        goto error;
+    }
+
+    map->log = log;
+    return log;
+
+error:
+    free(log->path);
+    free(log->buf);
+    free(log->spare);
+    free(log);
+    return NULL;
+
+mem_error:
+    perror("no enough memory");
+    return NULL;
+
+arg_error:
+    perror("hashmap is read only or already has a log, or argument ser/de_f is null");
+    return NULL;
+}
+
+bool hashmap_log_sync(const hashmap map) {
+    hashmap_log log = map->log;
+    if (log == NULL) return false;
+
+    pthread_mutex_lock(&log->lock);
+    uint64_t target = log->appended, compact_target = log->compact_req;
+    log->sync_waiters++;
+    pthread_cond_signal(&log->wake);
+    while ((log->durable < target || log->compact_done < compact_target) && !log->failed)
+        pthread_cond_wait(&log->durable_cond, &log->lock);
+    log->sync_waiters--;
+    // a failed compaction is reported once, the log is still complete without it.
+    bool ok = !log->failed && !log->compact_failed;
+    log->compact_failed = false;
+    pthread_mutex_unlock(&log->lock);
+    return ok;
+}
+
+bool hashmap_log_compact(const hashmap map) {
+    hashmap_log log = map->log;
+    if (log == NULL) return false;
+
+    // a newer compaction supersedes the pending one, its snapshot is freed so a new one could be taken.
+    pthread_mutex_lock(&log->lock);
+    hashmap old_snap = log->compact_snap;
+    free(log->compact_buf);
+    log->compact_pending = false;
+    log->compact_snap = NULL;
+    log->compact_buf = NULL;
+    pthread_mutex_unlock(&log->lock);
+    if (old_snap != NULL) hashmap_free(old_snap);
+
+    // serialized by writer from a snapshot, or in the map thread if map could not be snapshotted.
+    char   *buf = NULL;
+    size_t  len = 0;
+    hashmap snap = NULL;
+    _hashmap_cow_reap(map);
+    if (map->dense == NULL && map->cow == NULL) snap = hashmap_snapshot(map);
+    if (snap == NULL && !_hashmap_log_serialize(log, map, &buf, &len)) return false;
+
+    pthread_mutex_lock(&log->lock);
+    log->compact_pending = true;
+    log->compact_req++;
+    log->compact_snap = snap;
+    log->compact_buf = buf;
+    log->compact_len = len;
+    log->compact_off = log->len;
+    pthread_cond_signal(&log->wake);
+    pthread_mutex_unlock(&log->lock);
+    return true;
+}
+
+bool hashmap_log_close(const hashmap map) {
+    hashmap_log log = map->log;
+    if (log == NULL) return true;
+
+    pthread_mutex_lock(&log->lock);
+    log->stop = true;
+    pthread_cond_signal(&log->wake);
+    pthread_mutex_unlock(&log->lock);
+    pthread_join(log->writer, NULL);
+
+    bool ok = !log->failed;
+    close(log->fd);
+    pthread_mutex_destroy(&log->lock);
+    pthread_cond_destroy(&log->wake);
+    pthread_cond_destroy(&log->durable_cond);
+    free(log->path);
+    free(log->buf);
+    free(log->spare);
+    free(log->compact_buf);
+    free(log);
+    map->log = NULL;
+    return ok;
+}
@@ -0,0 +1,181 @@
+#include "c_hashmap_shard.h"
+#include "limits.h"
+#include <stdio.h>
+#include <string.h>
+
+sharded_hashmap sharded_hashmap_new(uint            shard_cnt,
+                                    size_t          init_cap,
+                                    attr_get_func   k_get_f,
+                                    attr_get_func   v_get_f,
+                                    val_update_func v_update_f,
+                                    hash_func       hash_f,
+                                    eq_func         k_eq_f,
+                                    eq_func         v_eq_f) {
+    // a negative init_cap wraps to above HASHMAP_MAX_CAP.
+    if (k_get_f == NULL || v_get_f == NULL || v_update_f == NULL || init_cap > HASHMAP_MAX_CAP) goto arg_error;
+
+    sharded_hashmap smap = (sharded_hashmap)calloc(1, sizeof(struct _sharded_hashmap));
+    if (smap == NULL) goto mem_error;
+
+    if (shard_cnt == 0) shard_cnt = DEFAULT_SHARD_CNT;
+    // avoid overflow
+    if (shard_cnt > 1 << 16) shard_cnt = 1 << 16;
+    smap->shard_cnt = round_up_power_of_2(shard_cnt);
+    while ((1u << smap->shard_bits) < smap->shard_cnt) smap->shard_bits++;
+
+    if (init_cap == 0) init_cap = DEFAULT_INIT_CAP * smap->shard_cnt;
+    smap->shard_init_cap = init_cap / smap->shard_cnt;
+    if (smap->shard_init_cap == 0) smap->shard_init_cap = DEFAULT_INIT_CAP;
+    smap->expand_factor = DEFAULT_EXPAND_FACTOR;
+    smap->shrink_factor = DEFAULT_SHRINK_FACTOR;
+
+    smap->k_get_f = k_get_f;
+    smap->v_get_f = v_get_f;
+    smap->v_update_f = v_update_f;
+    smap->hash_f = hash_f;
+    smap->k_eq_f = k_eq_f;
+    smap->v_eq_f = v_eq_f;
+
+    smap->shards = (hashmap_shard)aligned_alloc(SHARD_CACHE_LINE, smap->shard_cnt * sizeof(struct _hashmap_shard));
+    if (smap->shards == NULL) {
+        free(smap);
+        goto mem_error;
+    }
+    memset(smap->shards, 0, smap->shard_cnt * sizeof(struct _hashmap_shard));
+    for (uint i = 0; i < smap->shard_cnt; i++) pthread_rwlock_init(&smap->shards[i].lock, NULL);
+
+    return smap;
+
+mem_error:
+    perror("no enough memory");
+    return NULL;
+
+arg_error:
+    perror("argument k/v_get_f could not be null, or init_cap exceeds HASHMAP_MAX_CAP");
+    return NULL;
+}
+
+void sharded_hashmap_set_free_func(const sharded_hashmap smap, free_func free_f) {
+    smap->free_f = free_f;
+    for (uint i = 0; i < smap->shard_cnt; i++) {
+        hashmap_shard s = &smap->shards[i];
+        pthread_rwlock_wrlock(&s->lock);
+        if (s->map != NULL) hashmap_set_free_func(s->map, free_f);
+        pthread_rwlock_unlock(&s->lock);
+    }
+}
+
+// caller should hold the write lock of shard.
+hashmap _sharded_hashmap_shard_map(const sharded_hashmap smap, hashmap_shard s) {
+    if (s->map != NULL) return s->map;
+
+    s->map = hashmap_new_f(smap->shard_init_cap,
+                           smap->expand_factor,
+                           smap->shrink_factor,
+                           smap->k_get_f,
+                           smap->v_get_f,
+                           smap->v_update_f,
+                           smap->hash_f,
+                           smap->k_eq_f,
+                           smap->v_eq_f,
+                           smap->free_f);
+    return s->map;
+}
+
+bool sharded_hashmap_shard_init(const sharded_hashmap smap, uint shard_idx, int node) {
+    if (shard_idx >= smap->shard_cnt) return false;
+
+    hashmap_shard s = &smap->shards[shard_idx];
+    pthread_rwlock_wrlock(&s->lock);
+    hashmap map = _sharded_hashmap_shard_map(smap, s);
+    bool    ok = map != NULL;
+    if (ok && node >= 0) ok = hashmap_set_alloc_mode(map, HASHMAP_ALLOC_HUGE_PAGE | HASHMAP_ALLOC_NODE(node));
+    pthread_rwlock_unlock(&s->lock);
+    return ok;
+}
+
+/*
+ * Shards are picked by the high bits of the key's hash. The shard-local _hashmap indexes its buckets by the low bits,
+ * so keys of one shard still spread over all of its buckets.
+ */
+uint sharded_hashmap_shard_of(const sharded_hashmap smap, void *ele) {
+    if (smap->shard_bits == 0) return 0;
+
+    hash_func hash_f = smap->hash_f == NULL ? &ptr_hash_func : smap->hash_f;
+    return hash(hash_f, smap->k_get_f(ele)) >> (sizeof(size_t) * 8 - smap->shard_bits);
+}
+
+bool sharded_hashmap_contains_key(const sharded_hashmap smap, void *ele) {
+    hashmap_shard s = &smap->shards[sharded_hashmap_shard_of(smap, ele)];
+    pthread_rwlock_rdlock(&s->lock);
+    bool res = s->map != NULL && hashmap_contains_key(s->map, ele);
+    pthread_rwlock_unlock(&s->lock);
+    return res;
+}
+
+void *sharded_hashmap_get(const sharded_hashmap smap, void *ele) {
+    hashmap_shard s = &smap->shards[sharded_hashmap_shard_of(smap, ele)];
+    pthread_rwlock_rdlock(&s->lock);
+    void *v = s->map == NULL ? NULL : hashmap_get(s->map, ele);
+    pthread_rwlock_unlock(&s->lock);
+    return v;
+}
+
+void *sharded_hashmap_put(const sharded_hashmap smap, void *ele) {
+    hashmap_shard s = &smap->shards[sharded_hashmap_shard_of(smap, ele)];
+    pthread_rwlock_wrlock(&s->lock);
+    hashmap map = _sharded_hashmap_shard_map(smap, s);
+    void   *v = map == NULL ? NULL : hashmap_put(map, ele);
+    pthread_rwlock_unlock(&s->lock);
+    return v;
+}
+
+void *sharded_hashmap_put_if_absent(const sharded_hashmap smap, void *ele, void *def_ele) {
+    hashmap_shard s = &smap->shards[sharded_hashmap_shard_of(smap, ele)];
+    pthread_rwlock_wrlock(&s->lock);
+    hashmap map = _sharded_hashmap_shard_map(smap, s);
+    void   *v = map == NULL ? NULL : hashmap_put_if_absent(map, ele, def_ele);
+    pthread_rwlock_unlock(&s->lock);
+    return v;
+}
+
+void *sharded_hashmap_remove(const sharded_hashmap smap, void *ele) {
+    hashmap_shard s = &smap->shards[sharded_hashmap_shard_of(smap, ele)];
+    pthread_rwlock_wrlock(&s->lock);
+    void *v = s->map == NULL ? NULL : hashmap_remove(s->map, ele);
+    pthread_rwlock_unlock(&s->lock);
+    return v;
+}
+
+size_t sharded_hashmap_size(const sharded_hashmap smap) {
+    size_t size = 0;
+    for (uint i = 0; i < smap->shard_cnt; i++) {
+        hashmap_shard s = &smap->shards[i];
+        pthread_rwlock_rdlock(&s->lock);
+        if (s->map != NULL) size += s->map->size;
+        pthread_rwlock_unlock(&s->lock);
+    }
+    return size;
+}
+
+void sharded_hashmap_foreach(const sharded_hashmap smap, const hashmap_itr itr) {
+    for (uint i = 0; i < smap->shard_cnt; i++) {
+        hashmap_shard s = &smap->shards[i];
+        pthread_rwlock_rdlock(&s->lock);
+        bool stopped = s->map != NULL && hashmap_foreach(s->map, itr);
+        pthread_rwlock_unlock(&s->lock);
+        if (stopped) return;
+    }
+}
+
+void sharded_hashmap_free(sharded_hashmap smap) {
+    if (smap == NULL) return;
+
+    for (uint i = 0; i < smap->shard_cnt; i++) {
+        hashmap_free(smap->shards[i].map);
+        pthread_rwlock_destroy(&smap->shards[i].lock);
+    }
+    free(smap->shards);
+    free(smap);
+    smap = NULL;
+}
@@ -0,0 +1,204 @@
+#include "c_hashmultimap.h"
+#include "c_hashmap_internal.h"
+#include <stdio.h>
+#include <string.h>
+
+void *_hashmultimap_vals_key(void *ele) {
+    return ((hashmultimap_vals)ele)->key;
+}
+
+void *_hashmultimap_vals_self(void *ele) {
+    return ele;
+}
+
+// eles are appended through the entry directly, the underlying map never updates a value.
+void _hashmultimap_vals_no_update(void *ele1, void *ele2) {}
+
+hashmultimap hashmultimap_new(size_t        init_cap,
+                              attr_get_func k_get_f,
+                              hash_func     hash_f,
+                              eq_func       k_eq_f,
+                              eq_func       ele_eq_f) {
+    if (k_get_f == NULL) goto arg_error;
+
+    hashmultimap mm = (hashmultimap)calloc(1, sizeof(struct _hashmultimap));
+    if (mm == NULL) goto mem_error;
+
+    // vals are freed by hashmultimap along with their eles, so the underlying map has no free_func.
+    mm->map = hashmap_new(init_cap,
+                          &_hashmultimap_vals_key,
+                          &_hashmultimap_vals_self,
+                          &_hashmultimap_vals_no_update,
+                          hash_f,
+                          k_eq_f,
+                          NULL);
+    if (mm->map == NULL) {
+        free(mm);
+        return NULL;
+    }
+    mm->k_get_f = k_get_f;
+    mm->ele_eq_f = ele_eq_f == NULL ? &ptr_eq_func : ele_eq_f;
+    return mm;
+
+mem_error:
+    perror("no enough memory");
+    return NULL;
+
+arg_error:
+    perror("argument k_get_f could not be null");
+    return NULL;
+}
+
+void hashmultimap_set_free_func(const hashmultimap mm, free_func free_f) {
+    mm->free_f = free_f;
+}
+
+hash_map_entry _hashmultimap_get_entry(const hashmultimap mm, void *ele) {
+    void *k = mm->k_get_f(ele);
+    return _hashmap_find_entry(mm->map, k, hash(mm->map->hash_f, k), NULL);
+}
+
+bool hashmultimap_put(const hashmultimap mm, void *ele) {
+    void          *k = mm->k_get_f(ele);
+    size_t         h = hash(mm->map->hash_f, k);
+    hash_map_entry e = _hashmap_find_entry(mm->map, k, h, NULL);
+
+    hashmultimap_vals vals;
+    if (e == NULL) {
+        vals = (hashmultimap_vals)malloc(sizeof(struct _hashmultimap_vals) + MULTI_MAP_INIT_VALS_CAP * sizeof(void *));
+        if (vals == NULL) goto error;
+        vals->key = k;
+        vals->size = 0;
+        vals->cap = MULTI_MAP_INIT_VALS_CAP;
+
+        bool inserted;
+        if ((e = _hashmap_insert_entry(mm->map, vals, k, h, NULL, &inserted)) == NULL) {
+            free(vals);
+            return false;
+        }
+    }
+
+    vals = (hashmultimap_vals)e->ele;
+    if (vals->size == vals->cap) {
+        // doubled block size must not overflow size_t.
+        if (vals->cap > (SIZE_MAX - sizeof(struct _hashmultimap_vals)) / (2 * sizeof(void *))) goto error;
+        vals = (hashmultimap_vals)realloc(vals, sizeof(struct _hashmultimap_vals) + (vals->cap << 1) * sizeof(void *));
+        if (vals == NULL) goto error;
+        vals->cap <<= 1;
+        e->ele = vals;
+    }
+
+    vals->eles[vals->size++] = ele;
+    mm->size++;
+    return true;
+
+error:
+    perror("no enough memory");
+    return false;
+}
+
+void **hashmultimap_get(const hashmultimap mm, void *ele, size_t *cnt) {
+    hash_map_entry e = _hashmultimap_get_entry(mm, ele);
+    if (e == NULL) {
+        *cnt = 0;
+        return NULL;
+    }
+
+    hashmultimap_vals vals = (hashmultimap_vals)e->ele;
+    *cnt = vals->size;
+    return vals->eles;
+}
+
+bool hashmultimap_contains_key(const hashmultimap mm, void *ele) {
+    return _hashmultimap_get_entry(mm, ele) != NULL;
+}
+
+size_t hashmultimap_count(const hashmultimap mm, void *ele) {
+    hash_map_entry e = _hashmultimap_get_entry(mm, ele);
+    return e == NULL ? 0 : ((hashmultimap_vals)e->ele)->size;
+}
+
+bool hashmultimap_remove(const hashmultimap mm, void *ele) {
+    void          *k = mm->k_get_f(ele);
+    size_t         h = hash(mm->map->hash_f, k);
+    hash_map_entry e = _hashmap_find_entry(mm->map, k, h, NULL);
+    if (e == NULL) return false;
+
+    hashmultimap_vals vals = (hashmultimap_vals)e->ele;
+    for (size_t i = 0; i < vals->size; i++) {
+        if (!mm->ele_eq_f(vals->eles[i], ele)) continue;
+
+        void *removed = vals->eles[i];
+        memmove(vals->eles + i, vals->eles + i + 1, (vals->size - i - 1) * sizeof(void *));
+        vals->size--;
+        mm->size--;
+
+        if (vals->size == 0) {
+            _hashmap_remove_entry(mm->map, k, h);
+            free(vals);
+        } else if (i == 0) {
+            // cached key points into the removed ele, take it from the new first one.
+            vals->key = e->key = mm->k_get_f(vals->eles[0]);
+        }
+
+        if (mm->free_f != NULL) mm->free_f(removed);
+        return true;
+    }
+    return false;
+}
+
+size_t hashmultimap_remove_key(const hashmultimap mm, void *ele) {
+    void          *k = mm->k_get_f(ele);
+    size_t         h = hash(mm->map->hash_f, k);
+    hash_map_entry e = _hashmap_find_entry(mm->map, k, h, NULL);
+    if (e == NULL) return 0;
+
+    hashmultimap_vals vals = (hashmultimap_vals)e->ele;
+    _hashmap_remove_entry(mm->map, k, h);
+
+    size_t cnt = vals->size;
+    if (mm->free_f != NULL) {
+        for (size_t i = 0; i < cnt; i++) mm->free_f(vals->eles[i]);
+    }
+    free(vals);
+    mm->size -= cnt;
+    return cnt;
+}
+
+size_t hashmultimap_size(const hashmultimap mm) {
+    return mm->size;
+}
+
+bool hashmultimap_foreach(const hashmultimap mm, const hashmap_itr itr) {
+    hash_map_entry *b = mm->map->bucket;
+    hash_map_entry  e;
+    for (size_t i = 0; i < mm->map->cap; i++, b++) {
+        for (e = *b; e != NULL; e = e->next) {
+            hashmultimap_vals vals = (hashmultimap_vals)e->ele;
+            for (size_t j = 0; j < vals->size; j++) {
+                if (itr->filter_f != NULL && !itr->filter_f(vals->eles[j])) continue;
+                if (itr->foreach_f(vals->eles[j])) return true;
+            }
+        }
+    }
+    return false;
+}
+
+void hashmultimap_free(hashmultimap mm) {
+    if (mm == NULL) return;
+
+    hash_map_entry *b = mm->map->bucket;
+    hash_map_entry  e;
+    for (size_t i = 0; i < mm->map->cap; i++, b++) {
+        for (e = *b; e != NULL; e = e->next) {
+            hashmultimap_vals vals = (hashmultimap_vals)e->ele;
+            if (mm->free_f != NULL) {
+                for (size_t j = 0; j < vals->size; j++) mm->free_f(vals->eles[j]);
+            }
+            free(vals);
+        }
+    }
+    hashmap_free(mm->map);
+    free(mm);
+    mm = NULL;
+}
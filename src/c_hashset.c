@@ -0,0 +1,78 @@
+#include "c_hashset.h"
+#include "c_hashmap_internal.h"
+#include <stdio.h>
+
+// membership only, nothing to update for an existing key.
+void _hashset_no_update(void *ele1, void *ele2) {}
+
+hashset hashset_new(size_t init_cap, attr_get_func k_get_f, hash_func hash_f, eq_func k_eq_f) {
+    if (k_get_f == NULL) goto arg_error;
+
+    hashset set = (hashset)calloc(1, sizeof(struct _hashset));
+    if (set == NULL) goto mem_error;
+
+    // value getter is never called by hashset, key getter just fills the required slot.
+    set->map = hashmap_new(init_cap, k_get_f, k_get_f, &_hashset_no_update, hash_f, k_eq_f, k_eq_f);
+    if (set->map == NULL) {
+        free(set);
+        return NULL;
+    }
+    return set;
+
+mem_error:
+    perror("no enough memory");
+    return NULL;
+
+arg_error:
+    perror("argument k_get_f could not be null");
+    return NULL;
+}
+
+void hashset_set_free_func(const hashset set, free_func free_f) {
+    hashmap_set_free_func(set->map, free_f);
+}
+
+bool hashset_add(const hashset set, void *ele) {
+    bool  inserted;
+    void *k = set->map->k_get_f(ele);
+    _hashmap_insert_entry(set->map, ele, k, hash(set->map->hash_f, k), NULL, &inserted);
+    return inserted;
+}
+
+bool hashset_contains(const hashset set, void *ele) {
+    void *k = set->map->k_get_f(ele);
+    return _hashmap_find_entry(set->map, k, hash(set->map->hash_f, k), NULL) != NULL;
+}
+
+bool hashset_remove(const hashset set, void *ele) {
+    void *k = set->map->k_get_f(ele);
+    return _hashmap_remove_entry(set->map, k, hash(set->map->hash_f, k));
+}
+
+size_t hashset_size(const hashset set) {
+    return set->map->size;
+}
+
+size_t hashset_union(const hashset dst, const hashset other) {
+    return hashmap_merge_into(dst->map, other->map, NULL, 1);
+}
+
+size_t hashset_intersect(const hashset dst, const hashset other) {
+    return hashmap_intersect(dst->map, other->map, 1);
+}
+
+size_t hashset_difference(const hashset dst, const hashset other) {
+    return hashmap_diff(dst->map, other->map, 1);
+}
+
+bool hashset_foreach(const hashset set, const hashmap_itr itr) {
+    return hashmap_foreach(set->map, itr);
+}
+
+void hashset_free(hashset set) {
+    if (set == NULL) return;
+
+    hashmap_free(set->map);
+    free(set);
+    set = NULL;
+}
@@ -0,0 +1,104 @@
+#include "c_hashmap.h"
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Benchmark-threshold check of put and get, exits with 1 if any of them is slower than the given limit, or if get
+ * misses a put key.
+ * Each phase is run BENCH_ROUNDS times on a fresh map and the fastest round is compared, to filter out noise.
+ *
+ * usage: map_bench <cnt> <max_put_ns> <max_get_ns>
+ */
+
+#define BENCH_ROUNDS 3
+
+typedef struct _bench_ele {
+    int key;
+    int val;
+} bench_ele;
+
+void *bench_get_key(void *ele) {
+    return &((bench_ele *)ele)->key;
+}
+
+void *bench_get_val(void *ele) {
+    return &((bench_ele *)ele)->val;
+}
+
+void bench_update(void *ele1, void *ele2) {
+    ((bench_ele *)ele1)->val = ((bench_ele *)ele2)->val;
+}
+
+size_t bench_hash(void *k) {
+    return *(int *)k;
+}
+
+double bench_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <cnt> <max_put_ns> <max_get_ns>\n", argv[0]);
+        return 2;
+    }
+    int    cnt = atoi(argv[1]);
+    double max_put = atof(argv[2]), max_get = atof(argv[3]);
+    if (cnt <= 0) return 2;
+
+    bench_ele  *eles = (bench_ele *)malloc(cnt * sizeof(bench_ele));
+    bench_ele **order = (bench_ele **)malloc(cnt * sizeof(bench_ele *));
+    if (eles == NULL || order == NULL) {
+        perror("no enough memory");
+        return 2;
+    }
+    srand(1);
+    for (int i = 0; i < cnt; i++) {
+        eles[i] = (bench_ele){rand(), i};
+        order[i] = &eles[i];
+    }
+    // probe in another order than put, so get does not walk memory sequentially.
+    for (int i = cnt - 1; i > 0; i--) {
+        int        j = rand() % (i + 1);
+        bench_ele *t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    double put_ns = 0, get_ns = 0;
+    long   found = 0;
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        hashmap map = hashmap_new_default(&bench_get_key,
+                                          &bench_get_val,
+                                          &bench_update,
+                                          &bench_hash,
+                                          &int_eq_func,
+                                          &int_eq_func);
+        double  st = bench_now_ns();
+        for (int i = 0; i < cnt; i++) hashmap_put(map, &eles[i]);
+        double t = (bench_now_ns() - st) / cnt;
+        if (r == 0 || t < put_ns) put_ns = t;
+
+        st = bench_now_ns();
+        for (int i = 0; i < cnt; i++) found += hashmap_get(map, order[i]) != NULL;
+        t = (bench_now_ns() - st) / cnt;
+        if (r == 0 || t < get_ns) get_ns = t;
+        hashmap_free(map);
+    }
+
+    bool ok = put_ns <= max_put && get_ns <= max_get && found == (long)cnt * BENCH_ROUNDS;
+    printf("map_bench: cnt=%d, put %.1f ns/op (max %.1f), get %.1f ns/op (max %.1f), found %ld/%ld: %s\n",
+           cnt,
+           put_ns,
+           max_put,
+           get_ns,
+           max_get,
+           found,
+           (long)cnt * BENCH_ROUNDS,
+           ok ? "passed" : "FAILED");
+    free(order);
+    free(eles);
+    return ok ? 0 : 1;
+}
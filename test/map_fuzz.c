@@ -0,0 +1,404 @@
+#include "c_hashmap.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Operation-sequence fuzzer, checks _hashmap against a direct-mapped reference map.
+ *
+ * Each input is decoded into a map configuration and a sequence of operations on keys with ids in [0, FUZZ_KEY_SPACE),
+ * formatted to strings of different lengths, so interned keys are both inlined and stored in key chunks. After
+ * every operation the reference is compared with the map, the bucket structure and stored hashes are walked, and eles
+ * released through free_func are checked to never be reachable from the map or a live snapshot.
+ *
+ * Built with -DHASHMAP_FUZZ_LIBFUZZER and -fsanitize=fuzzer it's a libFuzzer target. Otherwise main() replays input
+ * files given as arguments or stdin (for AFL: map_fuzz @@), or runs random inputs with `map_fuzz -r <runs> [seed]`.
+ */
+
+#define FUZZ_KEY_SPACE 256
+#define FUZZ_MAX_SIDE 32
+#define FUZZ_KEY_MAX 48
+
+typedef struct _fuzz_ele {
+    int               id;
+    int               val;
+    bool              freed;
+    char              key[FUZZ_KEY_MAX];
+    struct _fuzz_ele *next_alloc;
+} fuzz_ele;
+
+typedef struct _fuzz_input {
+    const uint8_t *data;
+    size_t         size;
+    size_t         pos;
+} fuzz_input;
+
+enum fuzz_op {
+    FUZZ_PUT,
+    FUZZ_PUT_F,
+    FUZZ_PUT_IF_ABSENT,
+    FUZZ_REMOVE,
+    FUZZ_GET,
+    FUZZ_REMOVE_IF,
+    FUZZ_CLEAR,
+    FUZZ_RESERVE,
+    FUZZ_SNAPSHOT,
+    FUZZ_RELEASE,
+    FUZZ_CLONE,
+    FUZZ_MERGE,
+    FUZZ_INTERSECT,
+    FUZZ_DIFF,
+    FUZZ_FOREACH,
+    FUZZ_ELE_FREE_FUNC,
+    FUZZ_COMPACT,
+    FUZZ_OP_CNT
+};
+
+// eles are owned by the fuzzer and freed after each input, free_func only marks them.
+fuzz_ele *fuzz_eles;
+uint      fuzz_foreach_cnt;
+
+int  ref_val[FUZZ_KEY_SPACE];
+bool ref_has[FUZZ_KEY_SPACE];
+bool snap_has[FUZZ_KEY_SPACE];
+
+void fuzz_assert(bool cond, const char *msg, int key) {
+    if (cond) return;
+    fprintf(stderr, "map_fuzz: %s, key=%d\n", msg, key);
+    abort();
+}
+
+uint8_t fuzz_next(fuzz_input *in) {
+    return in->pos < in->size ? in->data[in->pos++] : 0;
+}
+
+// key lengths around HASHMAP_INLINE_KEY_SIZE.
+void fuzz_ele_init(fuzz_ele *ele, int id, int val) {
+    static const int widths[] = {3, HASHMAP_INLINE_KEY_SIZE - 1, HASHMAP_INLINE_KEY_SIZE, 40};
+    ele->id = id;
+    ele->val = val;
+    ele->freed = false;
+    snprintf(ele->key, FUZZ_KEY_MAX, "%0*d", widths[id & 3], id);
+}
+
+fuzz_ele *fuzz_ele_new(int id, int val) {
+    fuzz_ele *ele = (fuzz_ele *)calloc(1, sizeof(fuzz_ele));
+    fuzz_assert(ele != NULL, "no enough memory", id);
+    fuzz_ele_init(ele, id, val);
+    ele->next_alloc = fuzz_eles;
+    fuzz_eles = ele;
+    return ele;
+}
+
+void *fuzz_get_key(void *ele) {
+    return ((fuzz_ele *)ele)->key;
+}
+
+void *fuzz_get_val(void *ele) {
+    return &((fuzz_ele *)ele)->val;
+}
+
+void fuzz_update(void *ele1, void *ele2) {
+    ((fuzz_ele *)ele1)->val = ((fuzz_ele *)ele2)->val;
+}
+
+void fuzz_free(void *ele) {
+    fuzz_assert(!((fuzz_ele *)ele)->freed, "ele freed twice", ((fuzz_ele *)ele)->id);
+    ((fuzz_ele *)ele)->freed = true;
+}
+
+size_t fuzz_hash(void *k) {
+    return str_hash_func(k) * 2654435761u;
+}
+
+// keys collide in 4 long chains.
+size_t fuzz_bad_hash(void *k) {
+    return ((char *)k)[strlen((char *)k) - 1] & 3;
+}
+
+bool fuzz_odd_filter(void *ele) {
+    return ((fuzz_ele *)ele)->val & 1;
+}
+
+bool fuzz_count(void *ele) {
+    fuzz_assert(!((fuzz_ele *)ele)->freed, "foreach reached a freed ele", ((fuzz_ele *)ele)->id);
+    fuzz_foreach_cnt++;
+    return false;
+}
+
+// compare map with the expected key set, and values with the reference if check_val.
+void fuzz_verify(hashmap map, bool *has, bool check_val) {
+    size_t cnt = 0;
+    size_t entry_size = sizeof(struct _hash_map_entry) + (map->key_len_f == NULL ? 0 : HASHMAP_INLINE_KEY_SIZE);
+    for (size_t i = 0; i < map->cap; i++) {
+        for (hash_map_entry e = map->bucket[i]; e != NULL; e = e->next) {
+            fuzz_ele *ele = (fuzz_ele *)e->ele;
+            fuzz_assert(!ele->freed, "map holds a freed ele", ele->id);
+            fuzz_assert(ele->id >= 0 && ele->id < FUZZ_KEY_SPACE && has[ele->id], "unexpected key", ele->id);
+            if (map->key_len_f == NULL) fuzz_assert(e->key == map->k_get_f(ele), "stale cached key", ele->id);
+            else {
+                fuzz_assert(e->key != ele->key && e->key_len == strlen(ele->key), "key not interned", ele->id);
+                fuzz_assert(strcmp(e->key, ele->key) == 0, "interned key changed", ele->id);
+            }
+            fuzz_assert(e->hash == hash(map->hash_f, e->key), "stale cached hash", ele->id);
+            fuzz_assert((e->hash & (map->cap - 1)) == i, "entry in wrong bucket", ele->id);
+            if (map->dense != NULL) {
+                size_t off = (char *)e - map->dense;
+                fuzz_assert((char *)e >= map->dense && off < map->dense_len * entry_size && off % entry_size == 0,
+                            "entry out of dense storage",
+                            ele->id);
+            }
+            cnt++;
+        }
+    }
+    fuzz_assert(cnt == map->size, "size mismatch", (int)map->size);
+    fuzz_assert(map->dense == NULL || map->dense_len == cnt, "dense storage has holes", (int)map->dense_len);
+    // malloc_usable_size is only called on entries out of slabs, ASan reports it otherwise.
+    fuzz_assert(hashmap_memory_usage(map).entry == cnt * entry_size, "entry bytes mismatch", (int)cnt);
+
+    static fuzz_ele probes[FUZZ_KEY_SPACE];
+    void           *eles[FUZZ_KEY_SPACE], *vals[FUZZ_KEY_SPACE];
+    for (int k = 0; k < FUZZ_KEY_SPACE; k++) {
+        fuzz_ele_init(&probes[k], k, 0);
+        eles[k] = &probes[k];
+        int *v = (int *)hashmap_get(map, &probes[k]);
+        fuzz_assert((v != NULL) == has[k], has[k] ? "key lost" : "removed key found", k);
+        fuzz_assert(hashmap_contains_key(map, &probes[k]) == has[k], "contains_key disagrees with get", k);
+        if (check_val && v != NULL) fuzz_assert(*v == ref_val[k], "value mismatch", k);
+        vals[k] = v;
+    }
+
+    // the same probes through hashmap_get_batch, and through lookups interleaved 7 at a time.
+    void *batch[FUZZ_KEY_SPACE];
+    hashmap_get_batch(map, eles, batch, FUZZ_KEY_SPACE);
+    for (int k = 0; k < FUZZ_KEY_SPACE; k++) fuzz_assert(batch[k] == vals[k], "get_batch disagrees with get", k);
+    for (int k = 0; k < FUZZ_KEY_SPACE; k += 7) {
+        hashmap_lookup ls[7];
+        int            n = FUZZ_KEY_SPACE - k < 7 ? FUZZ_KEY_SPACE - k : 7, live = n;
+        for (int i = 0; i < n; i++) hashmap_lookup_begin(map, &ls[i], eles[k + i]);
+        while (live > 0) {
+            live = 0;
+            for (int i = 0; i < n; i++) live += !hashmap_lookup_step(map, &ls[i]);
+        }
+        for (int i = 0; i < n; i++) fuzz_assert(ls[i].val == vals[k + i], "lookup disagrees with get", k + i);
+    }
+}
+
+// build a map for bulk operations from the next bytes of input, with the same or another hash_func.
+hashmap fuzz_side_map(fuzz_input *in, hash_func hash_f, bool *side_has, int *side_val) {
+    memset(side_has, 0, FUZZ_KEY_SPACE * sizeof(bool));
+    uint8_t flags = fuzz_next(in);
+    hashmap side = hashmap_new(fuzz_next(in) % 64,
+                               &fuzz_get_key,
+                               &fuzz_get_val,
+                               &fuzz_update,
+                               flags & 1 ? &fuzz_hash : hash_f,
+                               &str_eq_func,
+                               &int_eq_func);
+    fuzz_assert(side != NULL, "no enough memory", 0);
+    if (flags & 4) hashmap_set_dense(side);
+    if (flags & 2) hashmap_intern_keys(side, &str_key_len_func);
+    uint cnt = fuzz_next(in) % FUZZ_MAX_SIDE;
+    for (uint i = 0; i < cnt; i++) {
+        int k = fuzz_next(in), v = fuzz_next(in);
+        if (side_has[k]) continue;
+        side_has[k] = true;
+        side_val[k] = v;
+        hashmap_put(side, fuzz_ele_new(k, v));
+    }
+    return side;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    fuzz_input in = {data, size, 0};
+    memset(ref_has, 0, sizeof(ref_has));
+
+    uint8_t   flags = fuzz_next(&in);
+    hash_func hash_f = flags & 1 ? &fuzz_bad_hash : &fuzz_hash;
+    hashmap   map = hashmap_new_f(fuzz_next(&in) % 64,
+                                flags & 2 ? 0.5 : DEFAULT_EXPAND_FACTOR,
+                                flags & 4 ? 0.4 : DEFAULT_SHRINK_FACTOR,
+                                &fuzz_get_key,
+                                &fuzz_get_val,
+                                &fuzz_update,
+                                hash_f,
+                                &str_eq_func,
+                                &int_eq_func,
+                                NULL);
+    fuzz_assert(map != NULL, "no enough memory", 0);
+    if (flags & 8) hashmap_set_alloc_mode(map, HASHMAP_ALLOC_HUGE_PAGE);
+    // set before interning, so dense storage is grown to the larger entries.
+    if (flags & 32) hashmap_set_dense(map);
+    if (flags & 16) hashmap_intern_keys(map, &str_key_len_func);
+
+    hashmap snap = NULL;
+    bool    side_has[FUZZ_KEY_SPACE];
+    int     side_val[FUZZ_KEY_SPACE];
+    while (in.pos < in.size) {
+        int       op = fuzz_next(&in) % FUZZ_OP_CNT;
+        int       k = fuzz_next(&in);
+        int       v = fuzz_next(&in);
+        fuzz_ele  probe;
+        fuzz_ele *ele;
+        hashmap   side, clone;
+        uint      cnt;
+        fuzz_ele_init(&probe, k, v);
+
+        switch (op) {
+            case FUZZ_PUT:
+            case FUZZ_PUT_F:
+                // map only takes ele of a new key.
+                ele = ref_has[k] ? &probe : fuzz_ele_new(k, v);
+                if (op == FUZZ_PUT) hashmap_put(map, ele);
+                else hashmap_put_f(map, ele, &fuzz_free);
+                ref_has[k] = true;
+                ref_val[k] = v;
+                break;
+            case FUZZ_PUT_IF_ABSENT:
+                ele = fuzz_ele_new(k, v);
+                hashmap_put_if_absent(map, &probe, ele);
+                if (!ref_has[k]) ref_val[k] = v;
+                ref_has[k] = true;
+                break;
+            case FUZZ_REMOVE:
+                hashmap_remove(map, &probe);
+                ref_has[k] = false;
+                break;
+            case FUZZ_GET:
+                fuzz_verify(map, ref_has, true);
+                break;
+            case FUZZ_REMOVE_IF:
+                cnt = 0;
+                for (int i = 0; i < FUZZ_KEY_SPACE; i++) {
+                    if (!ref_has[i] || !(ref_val[i] & 1)) continue;
+                    ref_has[i] = false;
+                    cnt++;
+                }
+                fuzz_assert(hashmap_remove_if(map, &fuzz_odd_filter) == cnt, "remove_if count mismatch", cnt);
+                break;
+            case FUZZ_CLEAR:
+                hashmap_clear(map);
+                memset(ref_has, 0, sizeof(ref_has));
+                break;
+            case FUZZ_RESERVE:
+                hashmap_reserve(map, map->size + k);
+                break;
+            case FUZZ_SNAPSHOT:
+                if (snap != NULL) break;
+                snap = hashmap_snapshot(map);
+                fuzz_assert((snap != NULL) == (map->dense == NULL), "snapshot failed", 0);
+                if (snap == NULL) break;
+                memcpy(snap_has, ref_has, sizeof(ref_has));
+                break;
+            case FUZZ_RELEASE:
+                if (snap == NULL) break;
+                // values are shared with map, only keys are fixed.
+                fuzz_verify(snap, snap_has, false);
+                hashmap_free(snap);
+                snap = NULL;
+                break;
+            case FUZZ_CLONE:
+                clone = hashmap_clone(map);
+                fuzz_assert(clone != NULL, "clone failed", 0);
+                fuzz_verify(clone, ref_has, true);
+                hashmap_free(clone);
+                break;
+            case FUZZ_MERGE:
+            case FUZZ_INTERSECT:
+            case FUZZ_DIFF:
+                side = fuzz_side_map(&in, hash_f, side_has, side_val);
+                // -1 to 3 threads, non-positive counts run in the caller thread.
+                if (op == FUZZ_MERGE) hashmap_merge_into(map, side, NULL, v % 5 - 1);
+                else if (op == FUZZ_INTERSECT) hashmap_intersect(map, side, v % 5 - 1);
+                else hashmap_diff(map, side, v % 5 - 1);
+                for (int i = 0; i < FUZZ_KEY_SPACE; i++) {
+                    if (op == FUZZ_MERGE && side_has[i]) {
+                        ref_has[i] = true;
+                        ref_val[i] = side_val[i];
+                    } else if (op != FUZZ_MERGE && side_has[i] == (op == FUZZ_DIFF)) ref_has[i] = false;
+                }
+                hashmap_free(side);
+                break;
+            case FUZZ_FOREACH:
+                fuzz_foreach_cnt = 0;
+                hashmap_itr itr = hashmap_itr_new(&fuzz_count);
+                hashmap_foreach(map, itr);
+                hashmap_itr_free(itr);
+                fuzz_assert(fuzz_foreach_cnt == map->size, "foreach count mismatch", fuzz_foreach_cnt);
+                break;
+            case FUZZ_ELE_FREE_FUNC:
+                fuzz_assert(hashmap_ele_set_free_func(map, &probe, &fuzz_free) == ref_has[k], "ele_set_free_func", k);
+                break;
+            case FUZZ_COMPACT:
+                fuzz_assert(hashmap_compact(map), "compact failed", (int)map->size);
+                fuzz_assert(map->cap == DEFAULT_INIT_CAP || map->size >= map->expand_factor * (map->cap >> 1),
+                            "compact left cap oversized",
+                            (int)map->cap);
+                break;
+        }
+
+        fuzz_assert(map->size <= FUZZ_KEY_SPACE, "size overflow", (int)map->size);
+        if (snap != NULL) fuzz_verify(snap, snap_has, false);
+    }
+
+    fuzz_verify(map, ref_has, true);
+    if (snap != NULL) hashmap_free(snap);
+    hashmap_free(map);
+    while (fuzz_eles != NULL) {
+        fuzz_ele *ele = fuzz_eles;
+        fuzz_eles = ele->next_alloc;
+        free(ele);
+    }
+    return 0;
+}
+
+#ifndef HASHMAP_FUZZ_LIBFUZZER
+int fuzz_file(FILE *f) {
+    size_t   size = 0, cap = 4096;
+    uint8_t *data = (uint8_t *)malloc(cap);
+    size_t   n;
+    while (data != NULL && (n = fread(data + size, 1, cap - size, f)) > 0) {
+        size += n;
+        if (size == cap) data = (uint8_t *)realloc(data, cap <<= 1);
+    }
+    if (data == NULL) {
+        perror("no enough memory");
+        return 1;
+    }
+    LLVMFuzzerTestOneInput(data, size);
+    free(data);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) return fuzz_file(stdin);
+
+    if (strcmp(argv[1], "-r") != 0) {
+        for (int i = 1; i < argc; i++) {
+            FILE *f = fopen(argv[i], "rb");
+            if (f == NULL) {
+                perror(argv[i]);
+                return 1;
+            }
+            int res = fuzz_file(f);
+            fclose(f);
+            if (res != 0) return res;
+        }
+        return 0;
+    }
+
+    long     runs = argc > 2 ? atol(argv[2]) : 1000;
+    unsigned seed = argc > 3 ? (unsigned)atol(argv[3]) : (unsigned)time(NULL);
+    printf("map_fuzz: %ld runs, seed %u\n", runs, seed);
+    srand(seed);
+    uint8_t data[4096];
+    for (long r = 0; r < runs; r++) {
+        size_t size = rand() % sizeof(data);
+        for (size_t i = 0; i < size; i++) data[i] = rand();
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    printf("map_fuzz: passed\n");
+    return 0;
+}
+#endif
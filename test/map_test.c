@@ -1,6 +1,19 @@
 #include "c_hashmap.h"
+#include "c_hashmap_log.h"
+#include "c_hashmap_shard.h"
+#include "c_hashmultimap.h"
+#include "c_hashset.h"
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 typedef struct _student {
     char *name;
@@ -42,6 +55,10 @@ void stu_update(void *stu1, void *stu2) {
     ((student *)stu1)->age = ((student *)stu2)->age;
 }
 
+void stu_set_age(void *stu1, void *stu2) {
+    ((student *)stu1)->age = ((student *)stu2)->age;
+}
+
 void stu_free(void *stu) {
     printf("freed: %s=%d\n", ((student *)stu)->name, ((student *)stu)->age);
     // can not free literal char sequence
@@ -64,14 +81,35 @@ bool filter_diff_func(void *stu) {
     return s->age != atoi(s->name);
 }
 
+size_t stu_serialize(void *stu, void *buf, size_t cap) {
+    student *s = (student *)stu;
+    size_t   len = strlen(s->name);
+    if (sizeof(int) + len <= cap) {
+        memcpy(buf, &s->age, sizeof(int));
+        memcpy((char *)buf + sizeof(int), s->name, len);
+    }
+    return sizeof(int) + len;
+}
+
+// name is stored right after student, so stu_free frees both.
+void *stu_deserialize(const void *buf, size_t len) {
+    size_t   name_len = len - sizeof(int);
+    student *s = malloc(sizeof(student) + name_len + 1);
+    s->name = (char *)(s + 1);
+    memcpy(&s->age, buf, sizeof(int));
+    memcpy(s->name, (char *)buf + sizeof(int), name_len);
+    s->name[name_len] = '\0';
+    return s;
+}
+
 void print_map(hashmap map) {
     hash_map_entry *b = map->bucket;
     hash_map_entry  e;
-    for (int i = 0; i < map->cap; i++, b++) {
+    for (size_t i = 0; i < map->cap; i++, b++) {
         if ((e = *b) == NULL) continue;
-        printf("%d\n", i);
+        printf("%zu\n", i);
         while (e != NULL) {
-            printf("----%d: %s=%d\n", e->hash, (char *)get_name(e->ele), *(int *)get_age(e->ele));
+            printf("----%zu: %s=%d\n", e->hash, (char *)get_name(e->ele), *(int *)get_age(e->ele));
             e = e->next;
         }
     }
@@ -98,7 +136,7 @@ void test_put(hashmap map) {
     hashmap_put(map, stus[6]);
     hashmap_put(map, stus[7]);
     printf("\n");
-    printf("Remained(%d/%d):\n", map->size, map->cap);
+    printf("Remained(%zu/%zu):\n", map->size, map->cap);
     print_map(map);
     printf("--------------------------------\n");
 }
@@ -117,7 +155,7 @@ void test_put_f(hashmap map) {
     hashmap_put_f(map, stus[2], &stu_free_plus);
     hashmap_put_f(map, stus[3], &stu_free_plus);
     hashmap_put_f(map, stus[4], &stu_free_plus);
-    printf("Remained(%d/%d):\n", map->size, map->cap);
+    printf("Remained(%zu/%zu):\n", map->size, map->cap);
     print_map(map);
     printf("--------------------------------\n");
 }
@@ -136,7 +174,7 @@ void test_put_if_absent(hashmap map) {
     hashmap_put_if_absent(map, stus[2], stus[2]);
     hashmap_put_if_absent_f(map, stus[3], &student_produce_func);
     hashmap_put_if_absent_f(map, stus[4], &student_produce_func);
-    printf("Remained(%d/%d):\n", map->size, map->cap);
+    printf("Remained(%zu/%zu):\n", map->size, map->cap);
     print_map(map);
     printf("--------------------------------\n");
 }
@@ -168,7 +206,7 @@ void test_get_or_default(hashmap map) {
 void test_contains(hashmap map) {
     printf("\n");
     printf("--------contains test--------\n");
-    printf("Remained(%d/%d):\n", map->size, map->cap);
+    printf("Remained(%zu/%zu):\n", map->size, map->cap);
     print_map(map);
     printf("\n");
     printf("Constains key Riicarus: %d\n", hashmap_contains_key(map, &(student){"Riicarus"}));
@@ -189,7 +227,7 @@ void test_remove(hashmap map) {
     hashmap_remove(map, &(student){"Alex"});
     hashmap_remove(map, &(student){"Bugee"});
     printf("\n");
-    printf("Remained(%d/%d):\n", map->size, map->cap);
+    printf("Remained(%zu/%zu):\n", map->size, map->cap);
     print_map(map);
     printf("--------------------------------\n");
 }
@@ -197,9 +235,9 @@ void test_remove(hashmap map) {
 void test_remove_if(hashmap map) {
     printf("\n");
     printf("--------remove if test--------\n");
-    printf("Removed count: %d\n", hashmap_remove_if(map, &student_filter_func));
+    printf("Removed count: %zu\n", hashmap_remove_if(map, &student_filter_func));
     printf("\n");
-    printf("Remained(%d/%d):\n", map->size, map->cap);
+    printf("Remained(%zu/%zu):\n", map->size, map->cap);
     print_map(map);
     printf("--------------------------------\n");
 }
@@ -212,6 +250,404 @@ void test_foreach(hashmap map) {
     printf("--------------------------------\n");
 }
 
+void test_snapshot(hashmap map) {
+    printf("\n");
+    printf("--------snapshot test--------\n");
+    hashmap snap = hashmap_snapshot(map);
+    hashmap_put(map, student_new("Snapper", 40));
+    hashmap_remove(map, &(student){"Bug"});
+    printf("Live(%zu/%zu):\n", map->size, map->cap);
+    print_map(map);
+    printf("Snapshot(%zu/%zu):\n", snap->size, snap->cap);
+    print_map(snap);
+    printf("Snapshot get: Bug=%d\n", *(int *)hashmap_get(snap, &(student){"Bug"}));
+    printf("Snapshot contains key Snapper: %d\n", hashmap_contains_key(snap, &(student){"Snapper"}));
+    hashmap_free(snap);
+    printf("--------------------------------\n");
+}
+
+void test_clone(hashmap map) {
+    printf("\n");
+    printf("--------clone test--------\n");
+    hashmap clone = hashmap_clone(map);
+    printf("Clone(%zu/%zu):\n", clone->size, clone->cap);
+    print_map(clone);
+    hashmap_free(clone);
+    printf("--------------------------------\n");
+}
+
+void test_merge() {
+    printf("\n");
+    printf("--------merge test--------\n");
+    hashmap m1 = hashmap_new_default(&get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    hashmap m2 = hashmap_new(64, &get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    hashmap_set_free_func(m2, &stu_free);
+    hashmap_put(m1, student_new("Riicarus", 22));
+    hashmap_put(m1, student_new("Alex", 20));
+    hashmap_put(m1, student_new("Scout", 32));
+    hashmap_put(m2, student_new("Alex", 21));
+    hashmap_put(m2, student_new("TheShy", 24));
+    hashmap_put(m2, student_new("Bug", 99));
+
+    hashmap m3 = hashmap_clone(m1);
+    printf("Merged new: %zu\n", hashmap_merge_into(m1, m2, NULL, 2));
+    printf("Remained(%zu/%zu):\n", m1->size, m1->cap);
+    print_map(m1);
+    printf("Intersect removed: %zu\n", hashmap_intersect(m1, m3, 2));
+    // eles shared with m2 are gone now.
+    hashmap_set_free_func(m1, &stu_free);
+    printf("Diff removed: %zu\n", hashmap_diff(m1, m2, 1));
+    printf("Remained(%zu/%zu):\n", m1->size, m1->cap);
+    print_map(m1);
+
+    hashmap_free(m3);
+    hashmap_free(m1);
+    hashmap_free(m2);
+    printf("--------------------------------\n");
+}
+
+void test_hashset() {
+    printf("\n");
+    printf("--------hashset test--------\n");
+    hashset s1 = hashset_new(0, &get_name, &str_hash_func, &str_eq_func);
+    hashset s2 = hashset_new(0, &get_name, &str_hash_func, &str_eq_func);
+    hashset_set_free_func(s1, &stu_free);
+    char *names1[] = {"Riicarus", "xiaoming", "xiaohu", "Alex", "Scout"};
+    char *names2[] = {"xiaohu", "Alex", "TheShy", "Bug"};
+    for (int i = 0; i < 5; i++) hashset_add(s1, student_new(names1[i], i));
+    for (int i = 0; i < 4; i++) hashset_add(s2, student_new(names2[i], i));
+    printf("Add duplicated Alex: %d\n", hashset_add(s1, &(student){"Alex"}));
+    printf("New with negative cap: %p\n", hashset_new(-1, &get_name, &str_hash_func, &str_eq_func));
+    printf("Contains Scout: %d, TheShy: %d\n",
+           hashset_contains(s1, &(student){"Scout"}),
+           hashset_contains(s1, &(student){"TheShy"}));
+
+    hashset s3 = hashset_new(0, &get_name, &str_hash_func, &str_eq_func);
+    hashset_union(s3, s1);
+    hashset_union(s3, s2);
+    printf("Union size: %zu\n", hashset_size(s3));
+    hashset_free(s3);
+
+    printf("Difference removed: %zu\n", hashset_difference(s1, s2));
+    printf("Remained(%zu):\n", hashset_size(s1));
+    print_map(s1->map);
+    hashset_add(s1, student_new("Bug", 99));
+    printf("Intersect removed: %zu\n", hashset_intersect(s1, s2));
+    printf("Remained(%zu):\n", hashset_size(s1));
+    print_map(s1->map);
+    hashset_free(s1);
+    hashset_set_free_func(s2, &stu_free);
+    hashset_free(s2);
+    printf("--------------------------------\n");
+}
+
+void test_hashmultimap() {
+    printf("\n");
+    printf("--------hashmultimap test--------\n");
+    hashmultimap mm = hashmultimap_new(0, &get_name, &str_hash_func, &str_eq_func, NULL);
+    hashmultimap_set_free_func(mm, &stu_free);
+    char *names[] = {"Riicarus", "Alex", "Riicarus", "Scout", "Riicarus", "Alex"};
+    for (int i = 0; i < 6; i++) hashmultimap_put(mm, student_new(names[i], i));
+    printf("Size: %zu, Riicarus: %zu, Alex: %zu, Bug: %zu\n",
+           hashmultimap_size(mm),
+           hashmultimap_count(mm, &(student){"Riicarus"}),
+           hashmultimap_count(mm, &(student){"Alex"}),
+           hashmultimap_count(mm, &(student){"Bug"}));
+
+    size_t cnt;
+    void **stus = hashmultimap_get(mm, &(student){"Riicarus"}, &cnt);
+    hashmultimap_remove(mm, stus[0]);
+    stus = hashmultimap_get(mm, &(student){"Riicarus"}, &cnt);
+    for (size_t i = 0; i < cnt; i++) printf("Get: Riicarus=%d\n", ((student *)stus[i])->age);
+    printf("Remove key Alex: %zu\n", hashmultimap_remove_key(mm, &(student){"Alex"}));
+
+    hashmap_itr itr = hashmap_itr_new(&foreach_f);
+    hashmultimap_foreach(mm, itr);
+    hashmap_itr_free(itr);
+    hashmultimap_free(mm);
+    printf("--------------------------------\n");
+}
+
+void test_sharded() {
+    printf("\n");
+    printf("--------sharded hashmap test--------\n");
+    sharded_hashmap smap =
+        sharded_hashmap_new(4, 0, &get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    sharded_hashmap_set_free_func(smap, &stu_free);
+    char *names[] = {"Riicarus", "xiaoming", "xiaohu", "Alex", "Scout"};
+    for (int i = 0; i < 5; i++) sharded_hashmap_put(smap, student_new(names[i], i));
+    sharded_hashmap_put(smap, &(student){"Alex", 21});
+    printf("Get: Alex=%d, Scout=%d, Bug=%p\n",
+           *(int *)sharded_hashmap_get(smap, &(student){"Alex"}),
+           *(int *)sharded_hashmap_get(smap, &(student){"Scout"}),
+           sharded_hashmap_get(smap, &(student){"Bug"}));
+    printf("Remove xiaoming: %d, Bug: %d\n",
+           sharded_hashmap_remove(smap, &(student){"xiaoming"}) != NULL,
+           sharded_hashmap_remove(smap, &(student){"Bug"}) != NULL);
+    printf("Contains xiaoming: %d, Size: %zu\n",
+           sharded_hashmap_contains_key(smap, &(student){"xiaoming"}),
+           sharded_hashmap_size(smap));
+    hashmap_itr itr = hashmap_itr_new(&foreach_f);
+    sharded_hashmap_foreach(smap, itr);
+    hashmap_itr_free(itr);
+    sharded_hashmap_free(smap);
+
+    // shard 0 is placed on node 0 by this thread, every machine has node 0. Enough keys to resize it.
+    int       cnt = 10000, got = 0;
+    student **stus = calloc(cnt, sizeof(student *));
+    smap = sharded_hashmap_new(4, 0, &get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    printf("Init shard 0 on node 0: %d, on node %d: %d\n",
+           sharded_hashmap_shard_init(smap, 0, 0),
+           HASHMAP_MAX_NODE,
+           sharded_hashmap_shard_init(smap, 1, HASHMAP_MAX_NODE));
+    for (int i = 0; i < cnt; i++) {
+        char *c = calloc(8, sizeof(char));
+        sprintf(c, "%d", i);
+        stus[i] = student_new(c, i);
+        sharded_hashmap_put(smap, stus[i]);
+    }
+    for (int i = 0; i < cnt; i++) {
+        int *age = sharded_hashmap_get(smap, stus[i]);
+        got += age != NULL && *age == i;
+    }
+    printf("Got %d/%d, shard 0 node: %d, cap: %zu\n",
+           got,
+           cnt,
+           HASHMAP_ALLOC_NODE_OF(smap->shards[0].map->alloc_mode),
+           smap->shards[0].map->cap);
+    sharded_hashmap_free(smap);
+    for (int i = 0; i < cnt; i++) {
+        free(stus[i]->name);
+        free(stus[i]);
+    }
+    free(stus);
+    printf("--------------------------------\n");
+}
+
+void test_log() {
+    printf("\n");
+    printf("--------log test--------\n");
+    char   *path = "map_test.log";
+    hashmap m1 = hashmap_new_default(&get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    hashmap_set_free_func(m1, &stu_free);
+    remove(path);
+    hashmap_log_open(m1, path, &stu_serialize, &stu_deserialize, &free);
+    hashmap_put(m1, student_new("Riicarus", 22));
+    hashmap_put(m1, student_new("Alex", 20));
+    hashmap_put(m1, student_new("Scout", 32));
+    hashmap_put(m1, &(student){"Alex", 21});
+    hashmap_remove(m1, &(student){"Scout"});
+    printf("Sync: %d\n", hashmap_log_sync(m1));
+    printf("Compact: %d\n", hashmap_log_compact(m1));
+    hashmap_put(m1, student_new("TheShy", 24));
+    hashmap_free(m1);
+
+    hashmap m2 = hashmap_new_default(&get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    hashmap_set_free_func(m2, &stu_free);
+    hashmap_log_open(m2, path, &stu_serialize, &stu_deserialize, &free);
+    printf("Replayed(%zu/%zu):\n", m2->size, m2->cap);
+    print_map(m2);
+    hashmap_free(m2);
+    remove(path);
+
+    // every update is a put record, replay should not keep capacity reserved for them.
+    hashmap m3 = hashmap_new_default(&get_name, &get_age, &stu_set_age, &str_hash_func, &str_eq_func, &str_eq_func);
+    hashmap_set_free_func(m3, &free);
+    hashmap_log_open(m3, path, &stu_serialize, &stu_deserialize, &free);
+    hashmap_put(m3, student_new("Riicarus", 0));
+    for (int i = 1; i <= 1000; i++) hashmap_put(m3, &(student){"Riicarus", i});
+    hashmap_free(m3);
+    m3 = hashmap_new_default(&get_name, &get_age, &stu_set_age, &str_hash_func, &str_eq_func, &str_eq_func);
+    hashmap_set_free_func(m3, &free);
+    hashmap_log_open(m3, path, &stu_serialize, &stu_deserialize, &free);
+    printf("Replayed updates(%zu/%zu): Riicarus=%d\n",
+           m3->size,
+           m3->cap,
+           *(int *)hashmap_get(m3, &(student){"Riicarus"}));
+    hashmap_free(m3);
+    remove(path);
+
+    // a directory in place of the compacted file fails the rewrite, the old log should still get all records.
+    char *compact_path = "map_test.log.compact";
+    hashmap m4 = hashmap_new_default(&get_name, &get_age, &stu_set_age, &str_hash_func, &str_eq_func, &str_eq_func);
+    hashmap_set_free_func(m4, &free);
+    hashmap_log_open(m4, path, &stu_serialize, &stu_deserialize, &free);
+    hashmap_put(m4, student_new("Riicarus", 22));
+    hashmap_put(m4, student_new("Alex", 20));
+    hashmap_put(m4, student_new("Scout", 32));
+    hashmap_log_sync(m4);
+    mkdir(compact_path, 0755);
+    hashmap_remove(m4, &(student){"Riicarus"});
+    printf("Compact: %d\n", hashmap_log_compact(m4));
+    hashmap_put(m4, student_new("TheShy", 24));
+    printf("Sync after failed compact: %d\n", hashmap_log_sync(m4));
+    printf("Sync again: %d\n", hashmap_log_sync(m4));
+    rmdir(compact_path);
+    size_t live_size = m4->size;
+    hashmap_free(m4);
+    m4 = hashmap_new_default(&get_name, &get_age, &stu_set_age, &str_hash_func, &str_eq_func, &str_eq_func);
+    hashmap_set_free_func(m4, &free);
+    hashmap_log_open(m4, path, &stu_serialize, &stu_deserialize, &free);
+    printf("Replayed after failed compact(%zu, live %zu): Riicarus=%d, TheShy=%d\n",
+           m4->size,
+           live_size,
+           hashmap_contains_key(m4, &(student){"Riicarus"}),
+           hashmap_contains_key(m4, &(student){"TheShy"}));
+    hashmap_free(m4);
+    remove(path);
+    printf("--------------------------------\n");
+}
+
+void test_intern() {
+    printf("\n");
+    printf("--------intern test--------\n");
+    hashmap map = hashmap_new_default(&get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    hashmap_set_free_func(map, &stu_free);
+    hashmap_intern_keys(map, &str_key_len_func);
+    hashmap_put(map, student_new("Riicarus", 22));
+    hashmap_put(map, student_new("Alex", 20));
+    hashmap_put(map, student_new("a_name_longer_than_inline_storage", 30));
+
+    // probe keys are compared by bytes, not by pointer.
+    char name[] = "a_name_longer_than_inline_storage";
+    printf("Get long: %d\n", *(int *)hashmap_get(map, &(student){name}));
+    hashmap_remove(map, &(student){"Alex"});
+    hashmap clone = hashmap_clone(map);
+    printf("Clone(%zu/%zu):\n", clone->size, clone->cap);
+    print_map(clone);
+    hashmap_free(clone);
+    hashmap_free(map);
+    printf("--------------------------------\n");
+}
+
+void print_mem_usage(const char *title, hashmap map) {
+    hashmap_mem_usage u = hashmap_memory_usage(map);
+    printf("%s(%zu/%zu): bucket: %zu, entry: %zu, key: %zu, overhead: %zu, total: %zu\n",
+           title,
+           map->size,
+           map->cap,
+           u.bucket,
+           u.entry,
+           u.key,
+           u.overhead,
+           u.total);
+}
+
+void stu_free_name(void *stu) {
+    free(((student *)stu)->name);
+    free(stu);
+}
+
+bool student_young_filter_func(void *stu) {
+    return ((student *)stu)->age < 90;
+}
+
+void test_compact() {
+    printf("\n");
+    printf("--------compact test--------\n");
+    hashmap map = hashmap_new_default(&get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    hashmap_set_free_func(map, &stu_free_name);
+    hashmap_intern_keys(map, &str_key_len_func);
+    for (int i = 0; i < 100; i++) {
+        char *c = calloc(32, sizeof(char));
+        sprintf(c, i % 2 ? "%d" : "a_name_longer_than_inline_%d", i);
+        hashmap_put(map, student_new(c, i));
+    }
+    print_mem_usage("Before", map);
+    hashmap_remove_if(map, &student_young_filter_func);
+    print_mem_usage("Removed", map);
+    hashmap_compact(map);
+    print_mem_usage("Compacted", map);
+    printf("Get: 99=%d\n", *(int *)hashmap_get(map, &(student){"99"}));
+    printf("Get: a_name_longer_than_inline_98=%d\n",
+           *(int *)hashmap_get(map, &(student){"a_name_longer_than_inline_98"}));
+    hashmap_free(map);
+    printf("--------------------------------\n");
+}
+
+void test_lookup() {
+    printf("\n");
+    printf("--------lookup test--------\n");
+    hashmap map = hashmap_new_default(&get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    hashmap_set_free_func(map, &stu_free);
+    char *names[] = {"Riicarus", "Alex", "Scout", "Bug", "TheShy"};
+    for (int i = 0; i < 3; i++) hashmap_put(map, student_new(names[i], 20 + i));
+
+    // step all lookups round-robin until every one is done.
+    hashmap_lookup ls[5];
+    int            live = 5;
+    for (int i = 0; i < 5; i++) hashmap_lookup_begin(map, &ls[i], &(student){names[i]});
+    while (live > 0) {
+        live = 0;
+        for (int i = 0; i < 5; i++) live += !hashmap_lookup_step(map, &ls[i]);
+    }
+    for (int i = 0; i < 5; i++) printf("Lookup: %s=%d\n", names[i], ls[i].val == NULL ? -1 : *(int *)ls[i].val);
+
+    student probes[5];
+    void   *eles[5], *vals[5];
+    for (int i = 0; i < 5; i++) {
+        probes[i].name = names[i];
+        eles[i] = &probes[i];
+    }
+    hashmap_get_batch(map, eles, vals, 5);
+    for (int i = 0; i < 5; i++) printf("Batch get: %s=%d\n", names[i], vals[i] == NULL ? -1 : *(int *)vals[i]);
+    hashmap_free(map);
+    printf("--------------------------------\n");
+}
+
+long long snapshot_sum;
+
+bool snapshot_sum_age(void *stu) {
+    snapshot_sum += ((student *)stu)->age;
+    return false;
+}
+
+// iterate and free the snapshot on another thread, like a background serializer does.
+void *snapshot_reader(void *snap) {
+    hashmap_itr itr = hashmap_itr_new(&snapshot_sum_age);
+    hashmap_foreach((hashmap)snap, itr);
+    hashmap_itr_free(itr);
+    hashmap_free((hashmap)snap);
+    return NULL;
+}
+
+void test_snapshot_thread() {
+    printf("\n");
+    printf("--------snapshot thread test--------\n");
+    int       cnt = 20000;
+    char      name[32];
+    pthread_t tid;
+    hashmap   map = hashmap_new_default(&get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    hashmap_set_free_func(map, &stu_free_name);
+    for (int i = 0; i < cnt; i++) {
+        char *c = calloc(32, sizeof(char));
+        sprintf(c, "stu_%d", i);
+        hashmap_put(map, student_new(c, 1));
+    }
+
+    // the live map keeps removing and putting while the snapshot is read and freed.
+    pthread_create(&tid, NULL, &snapshot_reader, hashmap_snapshot(map));
+    for (int i = 0; i < cnt; i++) {
+        sprintf(name, "stu_%d", i);
+        hashmap_remove(map, &(student){name});
+        char *c = calloc(32, sizeof(char));
+        sprintf(c, "new_stu_%d", i);
+        hashmap_put(map, student_new(c, 2));
+    }
+    pthread_join(tid, NULL);
+    printf("Snapshot sum: %lld\n", snapshot_sum);
+    hashmap_put(map, student_new(strdup("reaper"), 2));
+    printf("Live(%zu), snapshot released: %d\n", map->size, map->cow == NULL);
+
+    // the live map is freed while the snapshot is read, the last one freed releases the shared state.
+    snapshot_sum = 0;
+    pthread_create(&tid, NULL, &snapshot_reader, hashmap_snapshot(map));
+    hashmap_free(map);
+    pthread_join(tid, NULL);
+    printf("Snapshot sum after live freed: %lld\n", snapshot_sum);
+    printf("--------------------------------\n");
+}
+
 void test_free(hashmap map) {
     printf("\n");
     printf("--------free test--------\n");
@@ -230,7 +666,7 @@ void benchmark_put_expand() {
 
     student **stu_itr = stus;
     for (int i = 0; i < cnt; i++, stu_itr++) {
-        char *c = calloc(6, sizeof(char));
+        char *c = calloc(8, sizeof(char));
         sprintf(c, "%d", i);
         *stu_itr = student_new(c, i);
     }
@@ -312,6 +748,616 @@ void benchmark_get() {
     printf("--------------------------------\n");
 }
 
+// raw hash inverted through the finalizer of int_hash, every key maps to bucket 0 while full hashes still differ.
+size_t same_bucket_hash_func(void *k) {
+    size_t h = (size_t)(str_hash_func(k) & 0xffffffff) << 32;
+    h ^= h >> 33;
+    h *= 0x9cb4b2f8129337dbULL;
+    h ^= h >> 33;
+    h *= 0x4f74430c22a54005ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+student **long_key_students(int cnt, int key_len) {
+    student **stus = calloc(cnt, sizeof(student *));
+    for (int i = 0; i < cnt; i++) {
+        char *c = calloc(key_len + 1, sizeof(char));
+        memset(c, 'k', key_len);
+        sprintf(c + key_len - 8, "%08d", i);
+        stus[i] = student_new(c, i);
+    }
+    return stus;
+}
+
+long long benchmark_get_all(hashmap map, student **stus, int cnt, int rounds) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    long long st = tv.tv_sec * 1000000 + tv.tv_usec;
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < cnt; i++) hashmap_get(map, stus[i]);
+    }
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000 + tv.tv_usec - st;
+}
+
+// avg_time(unit: ns/op)--o3, 2000 keys of 64 bytes in one chain: 76850 before hash filter, 2260 after
+void benchmark_get_long_chain() {
+    printf("\n");
+    printf("--------benchmark get long chain--------\n");
+    int       cnt = 2000, rounds = 20;
+    hashmap   map = hashmap_new(cnt << 1,
+                              &get_name,
+                              &get_age,
+                              &stu_update,
+                              &same_bucket_hash_func,
+                              &str_eq_func,
+                              &str_eq_func);
+    student **stus = long_key_students(cnt, 64);
+    for (int i = 0; i < cnt; i++) hashmap_put(map, stus[i]);
+
+    long long t = benchmark_get_all(map, stus, cnt, rounds);
+    printf("total_op: %d, total_time: %lld us, avg: %f ns\n", cnt * rounds, t, t * 1000.0 / cnt / rounds);
+
+    hashmap_free(map);
+    for (int i = 0; i < cnt; i++) {
+        free(stus[i]->name);
+        free(stus[i]);
+    }
+    free(stus);
+    printf("--------------------------------\n");
+}
+
+// avg_time(unit: ns/op)--o3, 1e6 keys of 256 bytes: 1001 before hash filter, 965 after
+void benchmark_get_long_key() {
+    printf("\n");
+    printf("--------benchmark get long key--------\n");
+    int       cnt = 1000000, rounds = 1;
+    hashmap   map = hashmap_new(cnt, &get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    student **stus = long_key_students(cnt, 256);
+    for (int i = 0; i < cnt; i++) hashmap_put(map, stus[i]);
+
+    long long t = benchmark_get_all(map, stus, cnt, rounds);
+    printf("total_op: %d, total_time: %lld us, avg: %f ns\n", cnt * rounds, t, t * 1000.0 / cnt / rounds);
+
+    hashmap_free(map);
+    for (int i = 0; i < cnt; i++) {
+        free(stus[i]->name);
+        free(stus[i]);
+    }
+    free(stus);
+    printf("--------------------------------\n");
+}
+
+// random gets on a big map by probes of other memory than the stored keys.
+void benchmark_get_intern_mode(bool intern, int key_len) {
+    int       cnt = 2000000;
+    hashmap   map = hashmap_new(cnt, &get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    student **stus = long_key_students(cnt, key_len);
+    student **probes = long_key_students(cnt, key_len);
+    if (intern) hashmap_intern_keys(map, &str_key_len_func);
+    for (int i = 0; i < cnt; i++) hashmap_put(map, stus[i]);
+    for (int i = cnt - 1; i > 0; i--) {
+        int      j = rand() % (i + 1);
+        student *t = probes[i];
+        probes[i] = probes[j];
+        probes[j] = t;
+    }
+
+    long long t = benchmark_get_all(map, probes, cnt, 1);
+    printf("%s, key_len %d: avg: %f ns\n", intern ? "interned" : "ele keys", key_len, t * 1000.0 / cnt);
+
+    hashmap_free(map);
+    for (int i = 0; i < cnt; i++) {
+        free(stus[i]->name);
+        free(stus[i]);
+        free(probes[i]->name);
+        free(probes[i]);
+    }
+    free(stus);
+    free(probes);
+}
+
+// avg_time(unit: ns/op)--o3, 2e6 keys of 16 bytes: 977 by ele keys, 801 interned; of 64 bytes: 1604, 1111
+void benchmark_get_interned() {
+    printf("\n");
+    printf("--------benchmark get interned keys--------\n");
+    benchmark_get_intern_mode(false, 16);
+    benchmark_get_intern_mode(true, 16);
+    benchmark_get_intern_mode(false, 64);
+    benchmark_get_intern_mode(true, 64);
+    printf("--------------------------------\n");
+}
+
+// round-robin scheduler of n in-flight lookups, refilled from probes as lookups finish. Sums found ages.
+long long benchmark_lookup_all(hashmap map, student **probes, int cnt, int n, long long *sum) {
+    hashmap_lookup ls[64];
+    int            next = 0, live = 0;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    long long st = tv.tv_sec * 1000000 + tv.tv_usec;
+    for (; live < n && next < cnt; live++) hashmap_lookup_begin(map, &ls[live], probes[next++]);
+    while (live > 0) {
+        for (int i = 0; i < live; i++) {
+            if (!hashmap_lookup_step(map, &ls[i])) continue;
+            if (ls[i].val != NULL) *sum += *(int *)ls[i].val;
+            if (next < cnt) hashmap_lookup_begin(map, &ls[i], probes[next++]);
+            else ls[i--] = ls[--live];
+        }
+    }
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000 + tv.tv_usec - st;
+}
+
+// avg_time(unit: ns/op)--o3, 4e6 keys of 16 bytes: get 899, get_batch 802, 4/8/16/32 in flight: 439/387/408/380
+void benchmark_lookup_interleaved() {
+    printf("\n");
+    printf("--------benchmark interleaved lookup--------\n");
+    int       cnt = 4000000;
+    hashmap   map = hashmap_new(cnt, &get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    student **stus = long_key_students(cnt, 16);
+    student **probes = long_key_students(cnt, 16);
+    for (int i = 0; i < cnt; i++) hashmap_put(map, stus[i]);
+    for (int i = cnt - 1; i > 0; i--) {
+        int      j = rand() % (i + 1);
+        student *t = probes[i];
+        probes[i] = probes[j];
+        probes[j] = t;
+    }
+    void **vals = calloc(cnt, sizeof(void *));
+
+    struct timeval tv;
+    long long      sum = 0, st;
+    gettimeofday(&tv, NULL);
+    st = tv.tv_sec * 1000000 + tv.tv_usec;
+    for (int i = 0; i < cnt; i++) sum += *(int *)hashmap_get(map, probes[i]);
+    gettimeofday(&tv, NULL);
+    printf("get: avg: %f ns, sum: %lld\n", (tv.tv_sec * 1000000 + tv.tv_usec - st) * 1000.0 / cnt, sum);
+
+    sum = 0;
+    gettimeofday(&tv, NULL);
+    st = tv.tv_sec * 1000000 + tv.tv_usec;
+    hashmap_get_batch(map, (void **)probes, vals, cnt);
+    for (int i = 0; i < cnt; i++) sum += *(int *)vals[i];
+    gettimeofday(&tv, NULL);
+    printf("get_batch: avg: %f ns, sum: %lld\n", (tv.tv_sec * 1000000 + tv.tv_usec - st) * 1000.0 / cnt, sum);
+
+    for (int n = 4; n <= 32; n <<= 1) {
+        sum = 0;
+        long long t = benchmark_lookup_all(map, probes, cnt, n, &sum);
+        printf("%d in flight: avg: %f ns, sum: %lld\n", n, t * 1000.0 / cnt, sum);
+    }
+
+    hashmap_free(map);
+    for (int i = 0; i < cnt; i++) {
+        free(stus[i]->name);
+        free(stus[i]);
+        free(probes[i]->name);
+        free(probes[i]);
+    }
+    free(stus);
+    free(probes);
+    free(vals);
+    printf("--------------------------------\n");
+}
+
+// open a dTLB read miss counter of this thread, return -1 if not supported.
+int open_dtlb_miss_counter() {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+// random gets on a big map, with bucket array allocated by the given mode.
+void benchmark_get_alloc_mode(int alloc_mode, char *mode_name) {
+    int       cnt = 4000000;
+    hashmap   map = hashmap_new(cnt, &get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    student **stus = calloc(cnt, sizeof(student *));
+    hashmap_set_alloc_mode(map, alloc_mode);
+    for (int i = 0; i < cnt; i++) {
+        char *c = calloc(8, sizeof(char));
+        sprintf(c, "%d", i);
+        stus[i] = student_new(c, i);
+        hashmap_put(map, stus[i]);
+    }
+    for (int i = cnt - 1; i > 0; i--) {
+        int      j = rand() % (i + 1);
+        student *t = stus[i];
+        stus[i] = stus[j];
+        stus[j] = t;
+    }
+
+    long long misses = -1;
+    int       fd = open_dtlb_miss_counter();
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    long long t = benchmark_get_all(map, stus, cnt, 1);
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses)) misses = -1;
+        close(fd);
+    }
+#endif
+    if (misses < 0) printf("%s: avg: %f ns, dTLB misses: unavailable\n", mode_name, t * 1000.0 / cnt);
+    else printf("%s: avg: %f ns, dTLB misses: %f per op\n", mode_name, t * 1000.0 / cnt, (double)misses / cnt);
+
+    hashmap_free(map);
+    for (int i = 0; i < cnt; i++) {
+        free(stus[i]->name);
+        free(stus[i]);
+    }
+    free(stus);
+}
+
+void benchmark_huge_page() {
+    printf("\n");
+    printf("--------benchmark huge page get--------\n");
+    benchmark_get_alloc_mode(HASHMAP_ALLOC_DEFAULT, "default  ");
+    benchmark_get_alloc_mode(HASHMAP_ALLOC_HUGE_PAGE, "huge page");
+    printf("--------------------------------\n");
+}
+
+void *get_self(void *ele) {
+    return ele;
+}
+
+void self_update(void *ele1, void *ele2) {}
+
+// avg_time(unit: ns/op)--o3, 1e6 adds of 5e5 possible keys: 502 as map, 500 as set
+void benchmark_set_dedup() {
+    printf("\n");
+    printf("--------benchmark set dedup--------\n");
+    int    cnt = 1000000;
+    char **keys = calloc(cnt, sizeof(char *));
+    for (int i = 0; i < cnt; i++) {
+        keys[i] = calloc(8, sizeof(char));
+        sprintf(keys[i], "%d", rand() % (cnt >> 1));
+    }
+
+    struct timeval tv;
+    hashmap map = hashmap_new_default(&get_self, &get_self, &self_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    gettimeofday(&tv, NULL);
+    long long st = tv.tv_sec * 1000000 + tv.tv_usec;
+    for (int i = 0; i < cnt; i++) hashmap_put_if_absent(map, keys[i], keys[i]);
+    gettimeofday(&tv, NULL);
+    long long t = tv.tv_sec * 1000000 + tv.tv_usec - st;
+    printf("as map: size: %zu, avg: %f ns\n", map->size, t * 1000.0 / cnt);
+
+    hashset set = hashset_new(0, &get_self, &str_hash_func, &str_eq_func);
+    gettimeofday(&tv, NULL);
+    st = tv.tv_sec * 1000000 + tv.tv_usec;
+    for (int i = 0; i < cnt; i++) hashset_add(set, keys[i]);
+    gettimeofday(&tv, NULL);
+    t = tv.tv_sec * 1000000 + tv.tv_usec - st;
+    printf("as set: size: %zu, avg: %f ns\n", hashset_size(set), t * 1000.0 / cnt);
+
+    hashmap_free(map);
+    hashset_free(set);
+    for (int i = 0; i < cnt; i++) free(keys[i]);
+    free(keys);
+    printf("--------------------------------\n");
+}
+
+hashmap merge_target;
+
+bool merge_by_put(void *stu) {
+    hashmap_put(merge_target, stu);
+    return false;
+}
+
+// avg_time(unit: ns/op)--o3, merge 1e6 into 1e6 entries, half overlapped, 1 core: foreach + put: 155, merge_into: 89
+void benchmark_merge() {
+    printf("\n");
+    printf("--------benchmark merge--------\n");
+    int       cnt = 1000000;
+    student **stus = calloc(cnt << 1, sizeof(student *));
+    for (int i = 0; i < cnt << 1; i++) {
+        char *c = calloc(8, sizeof(char));
+        sprintf(c, "%d", i % (cnt + (cnt >> 1)));
+        stus[i] = student_new(c, i);
+    }
+    hashmap base = hashmap_new_default(&get_name, &get_age, &self_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    hashmap delta = hashmap_new_default(&get_name, &get_age, &self_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    for (int i = 0; i < cnt; i++) hashmap_put(base, stus[i]);
+    for (int i = cnt; i < cnt << 1; i++) hashmap_put(delta, stus[i]);
+
+    struct timeval tv;
+    char          *names[] = {"foreach + put", "merge_into", "merge_into(4 threads)"};
+    for (int m = 0; m < 3; m++) {
+        hashmap dst = hashmap_clone(base);
+        gettimeofday(&tv, NULL);
+        long long st = tv.tv_sec * 1000000 + tv.tv_usec;
+        if (m == 0) {
+            merge_target = dst;
+            hashmap_itr itr = hashmap_itr_new(&merge_by_put);
+            hashmap_foreach(delta, itr);
+            hashmap_itr_free(itr);
+        } else hashmap_merge_into(dst, delta, NULL, m == 1 ? 1 : 4);
+        gettimeofday(&tv, NULL);
+        long long t = tv.tv_sec * 1000000 + tv.tv_usec - st;
+        printf("%s: size: %zu, avg: %f ns\n", names[m], dst->size, t * 1000.0 / cnt);
+        hashmap_free(dst);
+    }
+
+    hashmap_free(base);
+    hashmap_free(delta);
+    for (int i = 0; i < cnt << 1; i++) {
+        free(stus[i]->name);
+        free(stus[i]);
+    }
+    free(stus);
+    printf("--------------------------------\n");
+}
+
+#define MT_THREAD_CNT 8
+
+typedef struct _mt_bench_arg {
+    student       **stus;
+    int             cnt;
+    hashmap         map;
+    pthread_mutex_t *lock;
+    sharded_hashmap smap;
+} mt_bench_arg;
+
+void *mt_put_locked(void *arg) {
+    mt_bench_arg *a = (mt_bench_arg *)arg;
+    for (int i = 0; i < a->cnt; i++) {
+        pthread_mutex_lock(a->lock);
+        hashmap_put(a->map, a->stus[i]);
+        pthread_mutex_unlock(a->lock);
+    }
+    for (int i = 0; i < a->cnt; i++) {
+        pthread_mutex_lock(a->lock);
+        hashmap_get(a->map, a->stus[i]);
+        pthread_mutex_unlock(a->lock);
+    }
+    return NULL;
+}
+
+void *mt_put_sharded(void *arg) {
+    mt_bench_arg *a = (mt_bench_arg *)arg;
+    for (int i = 0; i < a->cnt; i++) sharded_hashmap_put(a->smap, a->stus[i]);
+    for (int i = 0; i < a->cnt; i++) sharded_hashmap_get(a->smap, a->stus[i]);
+    return NULL;
+}
+
+long long run_mt_bench(void *(*f)(void *), mt_bench_arg *args) {
+    pthread_t      tids[MT_THREAD_CNT];
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    long long st = tv.tv_sec * 1000000 + tv.tv_usec;
+    for (int t = 0; t < MT_THREAD_CNT; t++) pthread_create(&tids[t], NULL, f, &args[t]);
+    for (int t = 0; t < MT_THREAD_CNT; t++) pthread_join(tids[t], NULL);
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000 + tv.tv_usec - st;
+}
+
+// compare one map guarded by a global lock with sharded map, each thread puts then gets its own keys.
+void benchmark_sharded_mt() {
+    printf("\n");
+    printf("--------benchmark sharded put/get(%d threads)--------\n", MT_THREAD_CNT);
+    int       cnt = 1000000;
+    student **stus = calloc(cnt, sizeof(student *));
+    for (int i = 0; i < cnt; i++) {
+        char *c = calloc(8, sizeof(char));
+        sprintf(c, "%d", i);
+        stus[i] = student_new(c, i);
+    }
+
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    hashmap map = hashmap_new_default(&get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    sharded_hashmap smap =
+        sharded_hashmap_new(0, 0, &get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+
+    mt_bench_arg args[MT_THREAD_CNT];
+    for (int t = 0; t < MT_THREAD_CNT; t++) {
+        args[t] = (mt_bench_arg){stus + t * (cnt / MT_THREAD_CNT), cnt / MT_THREAD_CNT, map, &lock, smap};
+    }
+
+    long long t1 = run_mt_bench(&mt_put_locked, args);
+    printf("global lock: total_op: %d, total_time: %lld us, avg: %f ns\n", cnt * 2, t1, t1 * 1000.0 / (cnt * 2));
+    long long t2 = run_mt_bench(&mt_put_sharded, args);
+    printf("sharded:     total_op: %d, total_time: %lld us, avg: %f ns\n", cnt * 2, t2, t2 * 1000.0 / (cnt * 2));
+
+    hashmap_free(map);
+    sharded_hashmap_free(smap);
+    for (int i = 0; i < cnt; i++) {
+        free(stus[i]->name);
+        free(stus[i]);
+    }
+    free(stus);
+    printf("--------------------------------\n");
+}
+
+long long scan_sum;
+
+bool student_not_tenth_filter_func(void *stu) {
+    return ((student *)stu)->age % 10 != 0;
+}
+
+bool sum_age(void *stu) {
+    scan_sum += ((student *)stu)->age;
+    return false;
+}
+
+long long benchmark_scan(hashmap map, int rounds) {
+    hashmap_itr    itr = hashmap_itr_new(&sum_age);
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    long long st = tv.tv_sec * 1000000 + tv.tv_usec;
+    for (int r = 0; r < rounds; r++) hashmap_foreach(map, itr);
+    gettimeofday(&tv, NULL);
+    hashmap_itr_free(itr);
+    return tv.tv_sec * 1000000 + tv.tv_usec - st;
+}
+
+// avg_time(unit: ns/ele)--o3, foreach over 4e5 eles left of 4e6: 102 before compact, 15 after, total bytes 59M to 28M
+void benchmark_compact() {
+    printf("\n");
+    printf("--------benchmark compact--------\n");
+    int       cnt = 4000000, rounds = 10;
+    hashmap   map = hashmap_new_default(&get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    student **stus = long_key_students(cnt, 16);
+    // interleave puts with other allocations, like a long running process does.
+    void    **noise = calloc(cnt, sizeof(void *));
+    for (int i = 0; i < cnt; i++) {
+        hashmap_put(map, stus[i]);
+        noise[i] = malloc(48);
+    }
+    hashmap_remove_if(map, &student_not_tenth_filter_func);
+    print_mem_usage("Removed", map);
+    long long t = benchmark_scan(map, rounds);
+    printf("scan: avg: %f ns, sum: %lld\n", t * 1000.0 / map->size / rounds, scan_sum);
+
+    hashmap_compact(map);
+    print_mem_usage("Compacted", map);
+    scan_sum = 0;
+    t = benchmark_scan(map, rounds);
+    printf("scan: avg: %f ns, sum: %lld\n", t * 1000.0 / map->size / rounds, scan_sum);
+
+    hashmap_free(map);
+    for (int i = 0; i < cnt; i++) {
+        free(stus[i]->name);
+        free(stus[i]);
+        free(noise[i]);
+    }
+    free(stus);
+    free(noise);
+    printf("--------------------------------\n");
+}
+
+void test_dense() {
+    printf("\n");
+    printf("--------dense test--------\n");
+    hashmap map = hashmap_new_default(&get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    hashmap_set_free_func(map, &stu_free_name);
+    printf("Set dense: %d\n", hashmap_set_dense(map));
+    printf("Intern keys: %d\n", hashmap_intern_keys(map, &str_key_len_func));
+    for (int i = 0; i < 100; i++) {
+        char *c = calloc(32, sizeof(char));
+        sprintf(c, i % 2 ? "%d" : "a_name_longer_than_inline_%d", i);
+        hashmap_put(map, student_new(c, i));
+    }
+    print_mem_usage("Before", map);
+    printf("Removed young: %zu\n", hashmap_remove_if(map, &student_young_filter_func));
+    printf("Removed 97: %d\n", hashmap_remove(map, &(student){"97"}) != NULL);
+    scan_sum = 0;
+    benchmark_scan(map, 1);
+    printf("Sum of ages: %lld\n", scan_sum);
+    printf("Contains value 95: %d\n", hashmap_contains_value(map, &(student){.age = 95}));
+    printf("Contains value 97: %d\n", hashmap_contains_value(map, &(student){.age = 97}));
+    printf("Snapshot of dense map: %d\n", hashmap_snapshot(map) != NULL);
+
+    hashmap clone = hashmap_clone(map);
+    printf("Clone: size=%zu, 99=%d\n", clone->size, *(int *)hashmap_get(clone, &(student){"99"}));
+    hashmap_free(clone);
+
+    hashmap_compact(map);
+    print_mem_usage("Compacted", map);
+    printf("Get: 99=%d\n", *(int *)hashmap_get(map, &(student){"99"}));
+    printf("Get: a_name_longer_than_inline_98=%d\n",
+           *(int *)hashmap_get(map, &(student){"a_name_longer_than_inline_98"}));
+    hashmap_clear(map);
+    printf("Cleared: size=%zu, get 99: %p\n", map->size, hashmap_get(map, &(student){"99"}));
+    hashmap_free(map);
+    printf("--------------------------------\n");
+}
+
+// full scans of a map built among other allocations, then again after 9/10 of entries are removed.
+void benchmark_scan_layout(bool dense) {
+    int       cnt = 4000000, rounds = 10;
+    hashmap   map = hashmap_new_default(&get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
+    student **stus = long_key_students(cnt, 16);
+    void    **noise = calloc(cnt, sizeof(void *));
+    if (dense) hashmap_set_dense(map);
+    for (int i = 0; i < cnt; i++) {
+        hashmap_put(map, stus[i]);
+        noise[i] = malloc(48);
+    }
+    scan_sum = 0;
+    long long t = benchmark_scan(map, rounds);
+    printf("%s full scan: avg: %f ns, sum: %lld\n", dense ? "dense" : "chained", t * 1000.0 / map->size / rounds,
+           scan_sum);
+
+    hashmap_remove_if(map, &student_not_tenth_filter_func);
+    scan_sum = 0;
+    t = benchmark_scan(map, rounds);
+    printf("%s sparse scan: avg: %f ns, sum: %lld\n", dense ? "dense" : "chained", t * 1000.0 / map->size / rounds,
+           scan_sum);
+
+    hashmap_free(map);
+    for (int i = 0; i < cnt; i++) {
+        free(stus[i]->name);
+        free(stus[i]);
+        free(noise[i]);
+    }
+    free(stus);
+    free(noise);
+}
+
+// avg_time(unit: ns/ele)--o3, foreach over 4e6 eles: chained 87, dense 9; over 4e5 left of them: chained 104, dense 12
+void benchmark_dense_scan() {
+    printf("\n");
+    printf("--------benchmark dense scan--------\n");
+    benchmark_scan_layout(false);
+    benchmark_scan_layout(true);
+    printf("--------------------------------\n");
+}
+
+// the integer key is the ele itself, so no memory is spent besides entries and buckets.
+void *get_int_key(void *ele) {
+    return ele;
+}
+
+size_t int_key_hash_func(void *k) {
+    return (size_t)k;
+}
+
+/*
+ * Scale test past 2^31 entries, needs about 80GB per 1e9 keys, run it on a large-memory box.
+ * avg_time(unit: ns/op)--o3, 2e7 keys: put 155, get 62
+ */
+void benchmark_put_scale(size_t cnt) {
+    printf("\n");
+    printf("--------benchmark put scale--------\n");
+    hashmap map = hashmap_new_default(&get_int_key, &get_int_key, &self_update, &int_key_hash_func, &ptr_eq_func, NULL);
+    hashmap_set_alloc_mode(map, HASHMAP_ALLOC_HUGE_PAGE);
+    hashmap_reserve(map, cnt);
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    long long st = tv.tv_sec * 1000000 + tv.tv_usec;
+    for (size_t i = 1; i <= cnt; i++) hashmap_put(map, (void *)i);
+    gettimeofday(&tv, NULL);
+    long long put_t = tv.tv_sec * 1000000 + tv.tv_usec - st;
+
+    size_t found = 0;
+    for (size_t i = 1; i <= cnt; i++) found += hashmap_get(map, (void *)i) == (void *)i;
+    gettimeofday(&tv, NULL);
+    long long get_t = tv.tv_sec * 1000000 + tv.tv_usec - st - put_t;
+
+    printf("size: %zu, cap: %zu, found: %zu\n", map->size, map->cap, found);
+    printf("put avg: %f ns, get avg: %f ns\n", put_t * 1000.0 / cnt, get_t * 1000.0 / cnt);
+    hashmap_free(map);
+    printf("--------------------------------\n");
+}
+
 int main() {
     hashmap map = hashmap_new(3, &get_name, &get_age, &stu_update, &str_hash_func, &str_eq_func, &str_eq_func);
     hashmap_set_free_func(map, &stu_free);
@@ -334,11 +1380,57 @@ int main() {
 
     test_put_if_absent(map);
 
+    test_snapshot(map);
+
+    test_snapshot_thread();
+
+    test_clone(map);
+
     test_free(map);
 
+    test_merge();
+
+    test_hashset();
+
+    test_hashmultimap();
+
+    test_sharded();
+
+    test_log();
+
+    test_intern();
+
+    test_lookup();
+
+    test_compact();
+
+    test_dense();
+
     benchmark_put_expand();
 
     // benchmark_put_no_expand();
 
     // benchmark_get();
+
+    // benchmark_get_long_chain();
+
+    // benchmark_get_long_key();
+
+    // benchmark_huge_page();
+
+    // benchmark_set_dedup();
+
+    // benchmark_merge();
+
+    // benchmark_sharded_mt();
+
+    // benchmark_get_interned();
+
+    // benchmark_lookup_interleaved();
+
+    // benchmark_compact();
+
+    // benchmark_dense_scan();
+
+    // benchmark_put_scale(3000000000UL);
 }
\ No newline at end of file